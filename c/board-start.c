@@ -19,12 +19,37 @@
 */
 #include "monitor.h"
 #include "mon-stdio.h"
+#if MON_MMU
+#include "mon-arm64-mmu.h"
+#endif
 
 extern uint64_t mon_startaddr, bss_start, bss_end, null_addr;
 
 typedef int (*fp_t)(int);
 
-volatile fp_t core_start_addr[4];
+/* core_start_addr[c] is non-NULL while core c is running something. It's in .data so that
+ * clearing the .bss on a warm restart can't make a core that's still running a program
+ * (e.g. one started with G) look idle to mon_parallel_cores().
+*/
+volatile fp_t core_start_addr[4] __attribute__((section(".data")));
+
+/* core_state[c] becomes CORE_IDLE when core c reaches core_start(). It's in .data, not .bss,
+ * so that core 0 clearing the .bss can't make a core look idle before it gets there.
+*/
+#define CORE_BOOTING	0x55
+#define CORE_IDLE		0
+
+static volatile int core_state[4] = { CORE_BOOTING, CORE_BOOTING, CORE_BOOTING, CORE_BOOTING };
+
+/* mon_boot_magic tells a cold boot from a warm restart (e.g. a program that returns
+ * to mon_reset). It's in .data, so it has MON_COLD when the image has just been loaded.
+ * Anything other than MON_WARM (e.g. if a program has scribbled over the monitor)
+ * counts as a cold boot.
+*/
+#define MON_COLD	0x434f4c44		/* "COLD" */
+#define MON_WARM	0x5741524d		/* "WARM" */
+
+static volatile uint32_t mon_boot_magic = MON_COLD;
 
 static void print_release_address(int c)
 {
@@ -34,37 +59,112 @@ static void print_release_address(int c)
 	m_printf("Release address for core %d : 0x%08x%08x\n", c, ah, al);
 }
 
+/* release() - start core c at address a
+ *
+ * The store-release makes everything written before it (e.g. a par_job) visible to core c
+ * before the address is; the SEV wakes the core from WFE in core_start().
+*/
 void release(int c, memaddr_t a)
 {
-	core_start_addr[c] = (fp_t) a;
+	__atomic_store_n(&core_start_addr[c], (fp_t) a, __ATOMIC_RELEASE);
+	bcm2835_cpu_sev();
+}
+
+/* The download receive pipeline
+ *
+ * During a download, core MON_PUMP_CORE drains the uart into the receive ring (see
+ * bcm2835_uart_pump() or pl011_uart_pump()) while core 0 decodes and writes memory. The pump is started with
+ * release() like any other function, so the core must be idle.
+*/
+#define MON_PUMP_CORE		1
+#define MON_PUMP_TIMEOUT	10000		/* 10 ms for the pump core to respond */
+
+static int pipeline_pump(int c)
+{
+	return mon_uart_pump(c);
+}
+
+static int pipeline_wait(int alive)
+{
+	uint32_t t0 = bcm2835_time_us();
+
+	while ( __atomic_load_n(&mon_uart_pump_alive, __ATOMIC_ACQUIRE) != alive )
+	{
+		if ( (bcm2835_time_us() - t0) > MON_PUMP_TIMEOUT )
+			return -1;
+	}
+	return 0;
+}
+
+/* mon_pipeline_start() - start the pump, if possible
+ *
+ * Returns 0 if the pump is running, -1 if not (e.g. the core is busy with a program
+ * that was started with G). The download works in either case.
+*/
+int mon_pipeline_start(void)
+{
+	if ( mon_uart_pumping )
+		return 0;
+
+	if ( !mon_uart_irqmode || core_start_addr[MON_PUMP_CORE] != NULL )
+		return -1;
+
+	mon_uart_pump_begin();
+	release(MON_PUMP_CORE, (memaddr_t)pipeline_pump);
+
+	if ( pipeline_wait(1) != 0 )
+	{
+		/* The core didn't respond. If it ever does, the pump returns immediately.
+		*/
+		__atomic_store_n(&mon_uart_pumping, 0, __ATOMIC_RELEASE);
+		mon_uart_pump_end();
+		return -1;
+	}
+	return 0;
+}
+
+/* mon_pipeline_stop() - stop the pump and go back to interrupt-driven receive
+*/
+void mon_pipeline_stop(void)
+{
+	if ( !mon_uart_pumping )
+		return;
+
+	__atomic_store_n(&mon_uart_pumping, 0, __ATOMIC_RELEASE);
+	pipeline_wait(0);
+	mon_uart_pump_end();
 }
 
 void core0_start(void)
 {
-	uint64_t *p;
+#if MON_MMU
+	/* Turn on the MMU and caches first, so that everything from here on is fast. The
+	 * other cores wait for the tables in core_start().
+	*/
+	mon_mmu_on();
+#endif
 
-    /* Enable the UART, then initialise it.
+    /* Initialise the UART (the mini uart or the PL011, see mon-stdio.h).
     */
-    bcm2835_enable(BCM2835_AUX_uart);
-    bcm2835_uart_init(115200, 8, 0);
+    mon_uart_init(115200);
 
     /* Friendly greeting.
     */
     m_printf("Davros monitor version 0.6\n");
     m_printf("... clearing bss\n");
-	p = &bss_start;
-	while ( p < &bss_end )
+	mon_zero((memaddr_t)&bss_start, (memaddr_t)&bss_end - (memaddr_t)&bss_start);
+
+	/* The uart's receive buffer is in the bss, so interrupts can only be used from here on.
+	*/
+	mon_uart_irq_start();
+	if ( mon_boot_magic == MON_WARM )
 	{
-		*p++ = 0;
+    	m_printf("... warm restart: memory kept\n");
 	}
-	if ( &mon_startaddr != &null_addr )
+	else
 	{
-    	m_printf("... clearing low memory\n");
-		p = &null_addr;
-		while ( p < &mon_startaddr )
-		{
-			*p++ = 0;
-		}
+		mon_clear_low();
+		mon_boot_magic = MON_WARM;
 	}
 
 	print_release_address(1);
@@ -74,19 +174,143 @@ void core0_start(void)
 	monitor("mon > ");
 }
 
+/* Large memory operations are split across all the cores
+ *
+ * mon_parallel_cores() gives a chunk of the range to each idle core (up to max cores in all)
+ * and does the last chunk itself. It returns the number of cores used. A core is finished
+ * when core_start() has cleared its core_start_addr[] entry. mon_parallel() uses all the
+ * cores, but only for big ranges.
+ * The boundaries between chunks are multiples of MON_PAR_ALIGN so that no two cores
+ * share a cache line.
+*/
+#define MON_PAR_MIN		0x100000		/* Smaller ranges are done on core 0 */
+#define MON_PAR_ALIGN	64
+
+static struct
+{
+	rangefunc_t fn;
+	memaddr_t a;
+	memaddr_t n;
+} par_job[4];
+
+static int parallel_worker(int c)
+{
+	par_job[c].fn(par_job[c].a, par_job[c].n);
+	__asm__ volatile ("dsb sy" : : : "memory");
+	return 0;
+}
+
+int mon_parallel_cores(rangefunc_t fn, memaddr_t a, memaddr_t n, int max)
+{
+	int cores[4];
+	int ncores = 0;
+	int c, i;
+	memaddr_t chunk, e;
+
+	for ( c = 1; c < 4 && ncores + 1 < max; c++ )
+	{
+		if ( core_state[c] == CORE_IDLE && core_start_addr[c] == NULL )
+			cores[ncores++] = c;
+	}
+
+	/* Each chunk must be at least MON_PAR_ALIGN bytes, otherwise a boundary rounded down
+	 * to a cache line might not be beyond the start of the chunk.
+	*/
+	chunk = n / (ncores + 1);
+	if ( ncores == 0 || chunk < MON_PAR_ALIGN )
+	{
+		fn(a, n);
+		return 1;
+	}
+
+	for ( i = 0; i < ncores; i++ )
+	{
+		c = cores[i];
+		e = (a + chunk) & ~(memaddr_t)(MON_PAR_ALIGN - 1);
+		par_job[c].fn = fn;
+		par_job[c].a = a;
+		par_job[c].n = e - a;
+		release(c, (memaddr_t)parallel_worker);
+		n -= e - a;
+		a = e;
+	}
+
+	fn(a, n);
+
+	/* Wait for the cores to finish their chunks. core_start() sends an event when it clears
+	 * the address.
+	*/
+	for ( i = 0; i < ncores; i++ )
+	{
+		while ( __atomic_load_n(&core_start_addr[cores[i]], __ATOMIC_ACQUIRE) != NULL )
+		{
+			bcm2835_cpu_wfe();
+		}
+	}
+	return ncores + 1;
+}
+
+void mon_parallel(rangefunc_t fn, memaddr_t a, memaddr_t n)
+{
+	if ( n >= MON_PAR_MIN )
+		mon_parallel_cores(fn, a, n, 4);
+	else
+		fn(a, n);
+}
+
+/* mon_clear_low() - clear all memory below the monitor
+*/
+void mon_clear_low(void)
+{
+	if ( &mon_startaddr != &null_addr )
+	{
+    	m_printf("... clearing low memory\n");
+		mon_parallel(mon_zero, (memaddr_t)&null_addr, (memaddr_t)&mon_startaddr - (memaddr_t)&null_addr);
+	}
+}
+
+/* core_start() - the idle loop of cores 1 to 3
+ *
+ * The core sleeps in WFE until release() gives it something to do, and sends an event
+ * when it has finished. A release address that the host pokes with W or Q comes
+ * without an SEV, so the timer's event stream also wakes the core every 2^(MON_PARK_EVENTS+1)
+ * ticks (about 0.4 ms at 19.2 MHz) to look.
+*/
+#define MON_PARK_EVENTS		12
+
 void core_start(int c)
 {
+	fp_t f;
+
+#if MON_MMU
+	mon_mmu_on_secondary();
+#endif
 	core_start_addr[c] = NULL;
+	core_state[c] = CORE_IDLE;
+	bcm2835_cpu_event_stream(MON_PARK_EVENTS);
 
 	for (;;)
 	{
-		if ( core_start_addr[c] != NULL )
+		f = __atomic_load_n(&core_start_addr[c], __ATOMIC_ACQUIRE);
+		if ( f != NULL )
 		{
-			int r = core_start_addr[c](c);
-			m_printf("Core %d: start function returned %d\n", c, r);
+			int r;
+
+#if MON_MMU
+			__asm__ volatile ("isb" : : : "memory");	/* See mon_sync_code() */
+#endif
+			r = f(c);
+
+			/* The pump and the workers are part of the monitor; their return is not news.
+			*/
+			if ( f != pipeline_pump && f != parallel_worker )
+				m_printf("Core %d: start function returned %d\n", c, r);
 
-			core_start_addr[c] = NULL;
+			__atomic_store_n(&core_start_addr[c], NULL, __ATOMIC_RELEASE);
+			bcm2835_cpu_sev();
 		}
+		else
+			bcm2835_cpu_wfe();
 	}
 }
 
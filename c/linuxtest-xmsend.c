@@ -0,0 +1,90 @@
+/*	linuxtest-xmsend.c - XMODEM-1K sender for testing the linux test board
+ *
+ *	Copyright 2020 David Haworth
+ *
+ *	This file is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2, or (at your option)
+ *	any later version.
+ *
+ *	It is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; see the file COPYING.  If not, write to
+ *	the Free Software Foundation, 59 Temple Place - Suite 330,
+ *	Boston, MA 02111-1307, USA.
+ *
+ *
+ *	This is a host program, not part of the monitor. It writes a file to stdout as
+ *	XMODEM-1K blocks (with CRC-16) followed by EOT, without waiting for the receiver.
+ *	That's enough to pipe a file into monitor-linuxtest for "make check":
+ *
+ *		(echo L; linuxtest-xmsend file.elf; echo W80000) | monitor-linuxtest
+ *
+ *	Usage:
+ *		linuxtest-xmsend file
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define STX		0x02
+#define EOT		0x04
+#define SUB		0x1a
+
+static uint16_t crc16(const uint8_t *p, int n)
+{
+	uint16_t crc = 0;
+	int i;
+
+	while ( n > 0 )
+	{
+		crc ^= (uint16_t)(*p++ << 8);
+		for ( i = 0; i < 8; i++ )
+			crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+		n--;
+	}
+	return crc;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f;
+	uint8_t data[1024];
+	uint8_t blk = 1;
+	size_t n;
+	uint16_t crc;
+
+	if ( argc != 2 )
+	{
+		fprintf(stderr, "Usage: %s file\n", argv[0]);
+		return 1;
+	}
+
+	f = fopen(argv[1], "rb");
+	if ( f == NULL )
+	{
+		perror(argv[1]);
+		return 1;
+	}
+
+	while ( (n = fread(data, 1, sizeof(data), f)) > 0 )
+	{
+		memset(&data[n], SUB, sizeof(data) - n);
+		crc = crc16(data, sizeof(data));
+		putchar(STX);
+		putchar(blk);
+		putchar(0xff - blk);
+		fwrite(data, 1, sizeof(data), stdout);
+		putchar(crc >> 8);
+		putchar(crc & 0xff);
+		blk++;
+	}
+	putchar(EOT);
+
+	fclose(f);
+	return 0;
+}
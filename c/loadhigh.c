@@ -19,6 +19,7 @@
 */
 #include "monitor.h"
 #include "mon-stdio.h"
+#include "mon-arm64-mmu.h"
 
 extern const char bin_name[];
 extern const unsigned char bin_array[];
@@ -38,6 +39,11 @@ volatile fp_t core_start_addr[4];
  *	1. The program also contains a copy of the reset code that catches all cores and puts three of them
  *	   to sleep until it needs them.
  *	2. The load address of the program is also the entry point.
+ *
+ * The binary is stored as an LZ4 frame (see s/loadbin.S). It is decompressed with the MMU
+ * and caches on; the runs of literals are copied 64 bytes at a time. Before the other cores
+ * are released the data cache is written back to memory and the MMU is turned off
+ * again, because the program starts with its MMU off.
 */
 
 static inline void release_core(int c, uint32_t entry)
@@ -45,7 +51,16 @@ static inline void release_core(int c, uint32_t entry)
 #if 0
 	m_printf("Release core %d at 0x%08x, rel_addr = 0x%08x\n", c, entry, (uint32_t)(uint64_t)&core_start_addr[c]);
 #endif
-	core_start_addr[c] = (fp_t)(uint64_t)entry;
+	__atomic_store_n(&core_start_addr[c], (fp_t)(uint64_t)entry, __ATOMIC_RELEASE);
+	bcm2835_cpu_sev();
+}
+
+/* load_sink() - the output of the decompressor goes straight to memory
+*/
+static int load_sink(memaddr_t a, const uint8_t *p, int n)
+{
+	mon_copy(a, (memaddr_t)p, (memaddr_t)n);
+	return 0;
 }
 
 static inline void wait_return(void)
@@ -61,24 +76,34 @@ static inline void wait_return(void)
 
 void core0_start(void)
 {
-	/* Enable the UART, then initialise it.
+	uint32_t t0;
+	long len;
+
+	/* Initialise the UART (the mini uart or the PL011, see mon-stdio.h).
 	*/
-	bcm2835_enable(BCM2835_AUX_uart);
-	bcm2835_uart_init(115200, 8, 0);
+	mon_uart_init(115200);
 
 	/* Friendly greeting.
 	*/
 	m_printf("Loadhigh version 0.3!\n");
 
-	/* Copy the data.
+	/* Decompress the binary to its load address.
 	*/
-	m_printf("Copying %s to 0x%08x\n", bin_name, bin_loadaddr);
-	unsigned char *d = (unsigned char *)(uint64_t)bin_loadaddr;
-	for ( unsigned i = 0; i < bin_length; i++ )
+	m_printf("Loading %s to 0x%08x\n", bin_name, bin_loadaddr);
+	t0 = bcm2835_time_us();
+	mon_mmu_on();
+	lz4_init((memaddr_t)bin_loadaddr, load_sink);
+	lz4_stream(bin_array, (int)bin_length);
+	len = lz4_finish();
+	mon_mmu_off();
+
+	if ( len < 0 )
 	{
-		d[i] = bin_array[i];
+		m_printf("Oops! The compressed image is damaged\n");
+		for (;;) {}
 	}
-	m_printf("Copied %u bytes to 0x%08x\n", bin_length, bin_loadaddr);
+	m_printf("Loaded %u bytes (%u compressed) to 0x%08x in %u us\n",
+				(unsigned)len, bin_length, bin_loadaddr, bcm2835_time_us() - t0);
 
 #if 0
 	m_printf("Press RETURN to start each core in turn\n");
@@ -111,17 +136,24 @@ void core0_start(void)
 	for (;;) {}
 }
 
+/* core_start() - cores 1 to 3 sleep in WFE until release_core() sends an event
+*/
 void core_start(int c)
 {
+	fp_t f;
+
 	core_start_addr[c] = NULL;
 
 	for (;;)
 	{
-		if ( core_start_addr[c] != NULL )
+		f = __atomic_load_n(&core_start_addr[c], __ATOMIC_ACQUIRE);
+		if ( f != NULL )
 		{
-			core_start_addr[c]();
+			f();
 			m_printf("Core %d: start function returned\n", c);
 		}
+		else
+			bcm2835_cpu_wfe();
 	}
 }
 
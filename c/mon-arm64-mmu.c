@@ -0,0 +1,117 @@
+/*	mon-arm64-mmu.c - ARM64 identity-mapped translation tables for monitor and loader
+ *
+ *	Copyright 2020 David Haworth
+ *
+ *	This file is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2, or (at your option)
+ *	any later version.
+ *
+ *	It is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; see the file COPYING.  If not, write to
+ *	the Free Software Foundation, 59 Temple Place - Suite 330,
+ *	Boston, MA 02111-1307, USA.
+ *
+ *
+ *	This file builds the translation tables for the 1:1 map described in mon-arm64-mmu.h.
+ *
+ *	4 KiB granule, 32-bit address space (T0SZ = 32), so the walk starts at level 1 with a
+ *	table of only 4 entries. The first GiB is a level 2 table of 2 MiB blocks, so that the
+ *	peripherals can be device memory. The second GiB is a single device block.
+ *
+ *	The tables are in their own section (.mmu), which isn't part of the image and isn't
+ *	cleared with the .bss. At a warm restart the other cores are still using them.
+*/
+#include "monitor.h"
+#include "mon-arm64-mmu.h"
+
+#define MMU_BLOCK		0x001			/* Levels 1 and 2 */
+#define MMU_TABLE		0x003
+#define MMU_ATTR(i)		((uint64_t)(i) << 2)
+#define MMU_ISH			(3 << 8)
+#define MMU_AF			(1 << 10)
+#define MMU_XN			((uint64_t)1 << 54)
+
+#define MAIR_DEVICE		0				/* Attribute index 0: device-nGnRE */
+#define MAIR_NORMAL		1				/* Attribute index 1: normal, write-back, read/write-allocate */
+#define MAIR_VALUE		0xff04
+
+#define MMU_NORMAL		(MMU_BLOCK | MMU_ATTR(MAIR_NORMAL) | MMU_ISH | MMU_AF)
+#define MMU_DEVICE		(MMU_BLOCK | MMU_ATTR(MAIR_DEVICE) | MMU_AF | MMU_XN)
+
+/* TCR: T0SZ = 32, inner and outer write-back write-allocate walks, inner shareable, 4 KiB
+ * granule, 32-bit physical addresses. Bit 23 is RES1 at EL2/EL3 (EPD1 at EL1) and
+ * bit 31 is RES1 at EL2/EL3 (part of TG1 = 4 KiB at EL1), so the same value does for all.
+*/
+#define TCR_VALUE		(32 | (1 << 8) | (1 << 10) | (3 << 12) | (1 << 23) | ((uint64_t)1 << 31))
+
+static struct
+{
+	uint64_t l2[512];
+	uint64_t l1[4];
+} mmu_tables __attribute__((section(".mmu"), aligned(4096)));
+
+/* mmu_ready is set by the core that builds the tables. It's in .data so that it's clear
+ * when the image has just been loaded, whatever was in memory before.
+*/
+static volatile int mmu_ready __attribute__((section(".data"))) = 0;
+
+static void mmu_build(void)
+{
+	uint64_t a;
+	int i;
+
+	for ( i = 0; i < 512; i++ )
+	{
+		a = (uint64_t)i << 21;
+		if ( a < BCM2835_PBASE )
+			mmu_tables.l2[i] = a | MMU_NORMAL;
+		else
+			mmu_tables.l2[i] = a | MMU_DEVICE;
+	}
+
+	mmu_tables.l1[0] = (uint64_t)mmu_tables.l2 | MMU_TABLE;
+	mmu_tables.l1[1] = ((uint64_t)1 << 30) | MMU_DEVICE;
+	mmu_tables.l1[2] = 0;
+	mmu_tables.l1[3] = 0;
+}
+
+/* mon_mmu_on() - build the tables and turn on the MMU and caches
+ *
+ * The tables are always built, because the loader doesn't clear its .bss. The table
+ * walks are cacheable (see TCR_VALUE), so this is safe with the MMU on too (e.g. at a warm
+ * restart); the tables don't change.
+*/
+void mon_mmu_on(void)
+{
+	mmu_build();
+
+	__asm__ volatile ("dsb sy" : : : "memory");
+	mmu_ready = 1;
+	__asm__ volatile ("dsb sy; sev" : : : "memory");	/* Wake the cores in mon_mmu_on_secondary() */
+	mon_mmu_enable(mmu_tables.l1, TCR_VALUE, MAIR_VALUE);
+}
+
+/* mon_mmu_on_secondary() - wait for another core to build the tables, then turn on the MMU
+ * and caches
+ *
+ * The core that calls this must have its MMU off, so mmu_ready is read from memory.
+*/
+void mon_mmu_on_secondary(void)
+{
+	while ( mmu_ready == 0 )
+	{
+		__asm__ volatile ("wfe" : : : "memory");
+	}
+	mon_mmu_enable(mmu_tables.l1, TCR_VALUE, MAIR_VALUE);
+}
+
+void mon_mmu_off(void)
+{
+	mon_mmu_disable();
+}
@@ -16,17 +16,127 @@
  *  along with this.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "mon-bcm2835.h"
+#include "mon-stdio.h"
 
+#if BCM2835_UART_IRQ
+int bcm2835_uart_throttled;			/* Receive interrupt off because the ring is full */
+static uint8_t rxbuf[BCM2835_RXBUF_SIZE];
+static uint8_t txbuf[BCM2835_TXBUF_SIZE];
+mon_ring_t bcm2835_rxring = MON_RING_INIT(rxbuf);
+mon_ring_t bcm2835_txring = MON_RING_INIT(txbuf);
+#endif
+int bcm2835_uart_irqmode;
+uint32_t bcm2835_uart_ier_rx;		/* BCM2835_IER_RxInt, or 0 while the pump is receiving */
+uint32_t bcm2835_uart_overruns;		/* Receive fifo overruns and characters dropped */
+int bcm2835_uart_flow;				/* RTS/CTS flow control: 0 = off, else the RTS level (1..4) */
+int bcm2835_uart_pumping;			/* Set by core 0 to keep the pump running */
+int bcm2835_uart_pump_alive;		/* Set by the pump core while it's in bcm2835_uart_pump() */
+
+/* bcm2835_uart_divisor() - calculate the baud divisor for a given rate
+ *
+ * Returns the divisor, or -1 if the rate can't be generated to within 2.5%.
+*/
+static int bcm2835_uart_divisor(uint32_t baud)
+{
+	uint32_t div, actual, err;
+
+	if ( baud == 0 || baud > BCM2835_CORE_CLK/8 )
+		return -1;
+
+	div = (BCM2835_CORE_CLK + 4 * baud) / (8 * baud);	/* Rounded */
+	if ( div < 1 || div > 0x10000 )
+		return -1;
+
+	actual = BCM2835_CORE_CLK / (8 * div);
+	err = (actual > baud) ? (actual - baud) : (baud - actual);
+	if ( err > baud / 40 )
+		return -1;
+
+	return (int)(div - 1);
+}
+
+/* bcm2835_uart_baudok() - returns nonzero if the rate is possible
+*/
+int bcm2835_uart_baudok(uint32_t baud)
+{
+	return ( bcm2835_uart_divisor(baud) >= 0 );
+}
+
+/* bcm2835_uart_setbaud() - change the baud rate
+ *
+ * Pending output is sent at the old rate first.
+ * Returns 0 if OK, -1 if the rate is not possible (nothing is changed).
+*/
+int bcm2835_uart_setbaud(uint32_t baud)
+{
+	int div = bcm2835_uart_divisor(baud);
+	uint32_t cntl;
+
+	if ( div < 0 )
+		return -1;
+
+	bcm2835_uart_flush();
+
+	cntl = bcm2835_uart.cntl;
+	bcm2835_uart.cntl = 0;
+	bcm2835_uart.baud = (uint32_t)div;
+	bcm2835_uart.cntl = cntl;
+
+	return 0;
+}
+
+/* bcm2835_uart_setflow() - turn RTS/CTS flow control on or off
+ *
+ * level 0 turns it off. 1 to 4 turns it on: the uart de-asserts RTS when there are only
+ * that many free places left in the receive fifo, and stops transmitting while CTS
+ * is de-asserted. 4 is the safest with a slow host adapter; it still gives half the fifo.
+ * Pending output is sent first.
+ * Returns 0 if OK, -1 if the level is not possible (nothing is changed).
+*/
+int bcm2835_uart_setflow(int level)
+{
+	static const uint8_t rtslevel[5] =
+	{	0, BCM2835_CNTL_Rts1, BCM2835_CNTL_Rts2, BCM2835_CNTL_Rts3, BCM2835_CNTL_Rts4	};
+	uint32_t cntl;
+
+	if ( level < 0 || level > 4 )
+		return -1;
+
+	bcm2835_uart_flush();
+
+	cntl = bcm2835_uart.cntl & (BCM2835_CNTL_TxEn | BCM2835_CNTL_RxEn);
+	if ( level == 0 )
+	{
+		bcm2835_uart.cntl = cntl;
+		bcm2835_gpio_pinconfig(16, BCM2835_pinfunc_input, BCM2835_pinpull_none);
+		bcm2835_gpio_pinconfig(17, BCM2835_pinfunc_input, BCM2835_pinpull_none);
+	}
+	else
+	{
+		/* A pull-down on CTS (asserted, if active low) lets output through if it isn't wired.
+		*/
+		bcm2835_gpio_pinconfig(16, BCM2835_pinfunc_alt5, BCM2835_pinpull_down);	/* CTS gpio16 */
+		bcm2835_gpio_pinconfig(17, BCM2835_pinfunc_alt5, BCM2835_pinpull_none);	/* RTS gpio17 */
+		bcm2835_uart.cntl = cntl | BCM2835_UART_FLOW_POL | rtslevel[level] |
+							BCM2835_CNTL_CtsFlow | BCM2835_CNTL_RtsFlow;
+	}
+	bcm2835_uart_flow = level;
+
+	return 0;
+}
 
 /* bcm2835_uart_init() - initialise the UART
  *
  * Initialize to the selected baud rate, parity and bits.
- * At the moment, baud and parity must be 115200 and none (0).
+ * Any baud rate that bcm2835_uart_divisor() can generate is allowed. 115200 gives a divisor of 270.
+ * Parity must be none (0).
  * Bits can be 7 or 8
 */
 void bcm2835_uart_init(uint32_t baud, uint32_t bits, uint32_t parity)
 {
-	if ( baud == 115200 &&			/* ToDo: Other bitrates */
+	int div = bcm2835_uart_divisor(baud);
+
+	if ( div >= 0 &&
 		 (bits == 7 || bits == 8) &&
 		 (parity == 0 ) )
 	{
@@ -36,7 +146,8 @@ void bcm2835_uart_init(uint32_t baud, uint32_t bits, uint32_t parity)
 		bcm2835_uart.ier = 0;				/* Interrupts disabled */
 		bcm2835_uart.lcr = (bits==7 ? BCM2835_LCR_7bit : BCM2835_LCR_8bit);
 		bcm2835_uart.mcr = 0;				/* RTS high (not used) */
-		bcm2835_uart.baud = 270;			/* 115200 */
+		bcm2835_uart.baud = (uint32_t)div;
+		bcm2835_uart_flow = 0;				/* See bcm2835_uart_setflow() */
 
 		bcm2835_gpio_pinconfig(14, BCM2835_pinfunc_alt5, BCM2835_pinpull_none);	/* Transmit pin gpio14 */
 		bcm2835_gpio_pinconfig(15, BCM2835_pinfunc_alt5, BCM2835_pinpull_none);	/* Receive pin gpio15 */
@@ -84,3 +195,241 @@ void bcm2835_gpio_pinconfig(uint32_t pin, uint32_t fsel, uint32_t pud)
 	bcm2835_gpio.pudclk[index] &= ~mask;
 	bcm2835_gpio.pud = 0;
 }
+
+#if BCM2835_UART_IRQ
+
+/* bcm2835_uart_irq_start() - switch the uart to interrupt-driven receive
+ *
+ * Must not be called before the bss has been cleared.
+*/
+void bcm2835_uart_irq_start(void)
+{
+	bcm2835_uart_irqmode = 1;
+	bcm2835_uart_ier_rx = BCM2835_IER_RxInt;
+	bcm2835_uart.ier = BCM2835_IER_Required | BCM2835_IER_RxInt;
+	bcm2835_irq_enable(BCM2835_IRQ_AUX);
+	bcm2835_cpu_irq_unmask();
+}
+
+/* bcm2835_uart_irq_stop() - switch the uart back to polled mode
+ *
+ * Used when handing the uart over to a loaded program. Pending output is sent first.
+ * Anything still in the receive ring is delivered after the next bcm2835_uart_irq_start().
+*/
+void bcm2835_uart_irq_stop(void)
+{
+	bcm2835_uart_flush();
+	bcm2835_cpu_irq_mask();
+	bcm2835_irq_disable(BCM2835_IRQ_AUX);
+	bcm2835_uart.ier = 0;
+	bcm2835_uart_irqmode = 0;
+}
+
+/* bcm2835_uart_irq() - uart interrupt handler
+ *
+ * Empties the receive fifo into the ring buffer. If the ring buffer is full the
+ * character is dropped (and counted); at least the hardware fifo doesn't overflow and
+ * lose a whole burst. With flow control the receive interrupt is turned off instead,
+ * until bcm2835_uart_unthrottle().
+ *
+ * Fills the transmit fifo from the ring buffer. When the ring is empty the transmit
+ * interrupt is disabled; bcm2835_uart_putc() enables it again.
+*/
+void bcm2835_uart_irq(void)
+{
+	uint8_t c;
+	uint32_t lsr;
+
+	while ( bcm2835_uart_ier_rx != 0 &&
+			((lsr = bcm2835_uart.lsr) & BCM2835_LSR_RxReady) != 0 )
+	{
+		if ( (lsr & BCM2835_LSR_RxOver) != 0 )
+			bcm2835_uart_overruns++;
+		if ( bcm2835_uart_flow != 0 && mon_ring_space(&bcm2835_rxring) == 0 )
+		{
+			/* Leave the rest in the fifo; RTS holds the host off.
+			*/
+			bcm2835_uart_throttled = 1;
+			bcm2835_uart_ier_rx = 0;
+			bcm2835_uart.ier = BCM2835_IER_Required |
+						( mon_ring_count(&bcm2835_txring) != 0 ? BCM2835_IER_TxInt : 0 );
+			break;
+		}
+		c = (uint8_t)bcm2835_uart.io;
+		if ( mon_ring_space(&bcm2835_rxring) > 0 )
+			mon_ring_put(&bcm2835_rxring, c);
+		else
+			bcm2835_uart_overruns++;
+	}
+
+	while ( mon_ring_count(&bcm2835_txring) > 0 && bcm2835_uart_istx() )
+	{
+		bcm2835_uart.io = mon_ring_get(&bcm2835_txring);
+	}
+	if ( mon_ring_count(&bcm2835_txring) == 0 )
+		bcm2835_uart.ier = BCM2835_IER_Required | bcm2835_uart_ier_rx;
+}
+
+/* bcm2835_uart_unthrottle() - turn the receive interrupt on again (on core 0)
+ *
+ * Called by bcm2835_uart_getc() while bcm2835_uart_throttled is set. Nothing happens until
+ * half the ring is free, so that the interrupt doesn't come back for every character.
+ * While the pump is running the interrupt stays off; bcm2835_uart_pump_end() turns it on.
+*/
+void bcm2835_uart_unthrottle(void)
+{
+	if ( mon_ring_space(&bcm2835_rxring) < BCM2835_RXBUF_SIZE / 2 )
+		return;
+
+	bcm2835_cpu_irq_mask();
+	bcm2835_uart_throttled = 0;
+	if ( !__atomic_load_n(&bcm2835_uart_pumping, __ATOMIC_ACQUIRE) )
+	{
+		bcm2835_uart_ier_rx = BCM2835_IER_RxInt;
+		bcm2835_uart.ier = BCM2835_IER_Required | BCM2835_IER_RxInt |
+					( mon_ring_count(&bcm2835_txring) != 0 ? BCM2835_IER_TxInt : 0 );
+	}
+	bcm2835_cpu_irq_unmask();
+}
+
+/* bcm2835_uart_pump_begin() - hand the receive side over to the pump (on core 0)
+ *
+ * The receive interrupt is turned off before the pump is started, so the
+ * receive ring never has two producers.
+*/
+void bcm2835_uart_pump_begin(void)
+{
+	bcm2835_cpu_irq_mask();
+	bcm2835_uart_ier_rx = 0;
+	bcm2835_uart.ier = BCM2835_IER_Required |
+				( mon_ring_count(&bcm2835_txring) != 0 ? BCM2835_IER_TxInt : 0 );
+	__atomic_store_n(&bcm2835_uart_pumping, 1, __ATOMIC_RELEASE);
+	bcm2835_cpu_irq_unmask();
+}
+
+/* bcm2835_uart_pump_end() - take the receive side back from the pump (on core 0)
+ *
+ * The caller must wait for bcm2835_uart_pump_alive to go to zero after clearing
+ * bcm2835_uart_pumping. Anything that arrived in the meantime is in the fifo and
+ * causes an interrupt straight away.
+*/
+void bcm2835_uart_pump_end(void)
+{
+	bcm2835_cpu_irq_mask();
+	bcm2835_uart_ier_rx = BCM2835_IER_RxInt;
+	bcm2835_uart.ier = BCM2835_IER_Required | BCM2835_IER_RxInt |
+				( mon_ring_count(&bcm2835_txring) != 0 ? BCM2835_IER_TxInt : 0 );
+	bcm2835_cpu_irq_unmask();
+}
+
+/* bcm2835_uart_pump() - receive loop for another core
+ *
+ * Drains the receive fifo into the receive ring for as long as bcm2835_uart_pumping
+ * is set. The fifo is only 8 bytes deep, so this keeps up with any baud rate
+ * even while core 0 is busy decoding and writing memory.
+*/
+int bcm2835_uart_pump(int core)
+{
+	uint8_t c;
+	uint32_t lsr;
+
+	__atomic_store_n(&bcm2835_uart_pump_alive, 1, __ATOMIC_RELEASE);
+
+	while ( __atomic_load_n(&bcm2835_uart_pumping, __ATOMIC_ACQUIRE) )
+	{
+		lsr = bcm2835_uart.lsr;
+		if ( (lsr & BCM2835_LSR_RxOver) != 0 )
+			bcm2835_uart_overruns++;
+		if ( (lsr & BCM2835_LSR_RxReady) != 0 )
+		{
+			if ( bcm2835_uart_flow != 0 && mon_ring_space(&bcm2835_rxring) == 0 )
+				continue;		/* Leave it in the fifo; RTS holds the host off */
+			c = (uint8_t)bcm2835_uart.io;
+			if ( mon_ring_space(&bcm2835_rxring) > 0 )
+				mon_ring_put(&bcm2835_rxring, c);
+			else
+				bcm2835_uart_overruns++;
+		}
+	}
+
+	__atomic_store_n(&bcm2835_uart_pump_alive, 0, __ATOMIC_RELEASE);
+	return 0;
+}
+
+#else
+
+void bcm2835_uart_irq_start(void)
+{
+}
+
+void bcm2835_uart_irq_stop(void)
+{
+}
+
+void bcm2835_uart_irq(void)
+{
+}
+
+void bcm2835_uart_pump_begin(void)
+{
+}
+
+void bcm2835_uart_pump_end(void)
+{
+}
+
+void bcm2835_uart_unthrottle(void)
+{
+}
+
+int bcm2835_uart_pump(int core)
+{
+	return 0;
+}
+
+#endif
+
+/* bcm2835_uart_flush() - wait until all output has been sent
+*/
+void bcm2835_uart_flush(void)
+{
+#if BCM2835_UART_IRQ
+	if ( bcm2835_uart_irqmode )
+	{
+		while ( mon_ring_count(&bcm2835_txring) != 0 )
+		{
+			/* Wait till the interrupt handler has emptied the ring */
+		}
+	}
+#endif
+	while ( (bcm2835_uart.stat & BCM2835_STAT_TxDone) == 0 )
+	{
+		/* Wait till the fifo and shift register are empty */
+	}
+}
+
+/* mon_irq() - called from the IRQ vector
+*/
+void mon_irq(void)
+{
+#if MON_CONSOLE == MON_PL011
+	if ( (bcm2835_intc.pending[BCM2835_IRQ_UART/32] & (1 << (BCM2835_IRQ_UART%32))) != 0 )
+		pl011_uart_irq();
+#else
+	if ( (bcm2835_aux.irq & BCM2835_AUX_uart) != 0 )
+		bcm2835_uart_irq();
+#endif
+}
+
+/* mon_unexpected() - called from all the other exception vectors
+ *
+ * There's nothing sensible to do except report it. The uart is used in polled mode.
+*/
+void mon_unexpected(int vector)
+{
+	mon_uart_irqmode = 0;
+	m_printf("Unexpected exception, vector offset 0x%x\n", vector);
+	for (;;)
+	{
+	}
+}
@@ -0,0 +1,257 @@
+/*	mon-bench.c - monitor memory benchmark
+ *
+ *	Copyright 2020 David Haworth
+ *
+ *	This file is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2, or (at your option)
+ *	any later version.
+ *
+ *	It is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; see the file COPYING.  If not, write to
+ *	the Free Software Foundation, 59 Temple Place - Suite 330,
+ *	Boston, MA 02111-1307, USA.
+ *
+ *
+ *	This file contains the memory benchmark (the A command).
+ *
+ *	Bandwidth: the four STREAM kernels (copy, scale, add and triad) on three arrays of
+ *	doubles that share the range equally. Each kernel is run BENCH_NTIMES times and
+ *	the best time is reported, as STREAM does. The bytes counted are the ones the
+ *	kernel reads and writes (16 per element for copy and scale, 24 for add and triad).
+ *
+ *	Latency: a pointer chase through the range, one pointer every stride bytes, in a
+ *	random order (a single cycle, made with Sattolo's algorithm) so that the prefetcher
+ *	can't help. Each core follows BENCH_CHASE_STEPS pointers.
+ *
+ *	With more than one core, every kernel is split across the cores with
+ *	mon_parallel_cores(); each core chases a cycle in its own part of the range. The
+ *	times are measured on core 0, from the start of the kernel until all the cores
+ *	have finished.
+ *
+ *	The benchmark overwrites the range.
+*/
+#include "monitor.h"
+#include "mon-stdio.h"
+
+#define BENCH_NTIMES		4
+#define BENCH_CHASE_STEPS	(1 << 22)
+
+/* The timer: the ARM generic timer on the pi3, microseconds elsewhere.
+*/
+#if MON_BOARD == MON_PI3_ARM64
+static inline uint64_t bench_ticks(void)
+{
+	uint64_t t;
+	__asm__ volatile ("isb; mrs %0, cntpct_el0" : "=r" (t) : : "memory");
+	return t;
+}
+
+/* CNTFRQ_EL0 is set by the armstub. Without one (kernel_old=1) it might not be, but
+ * the counter still runs at the crystal frequency.
+*/
+static uint64_t bench_freq(void)
+{
+	uint64_t f;
+	__asm__ volatile ("mrs %0, cntfrq_el0" : "=r" (f));
+	return ( f == 0 ) ? 19200000 : f;
+}
+#else
+#define bench_ticks()	((uint64_t)mon_time_us())
+#define bench_freq()	((uint64_t)1000000)
+#endif
+
+static struct
+{
+	double *a, *b, *c;			/* The STREAM arrays */
+	memaddr_t base;				/* The chase */
+	memaddr_t stride;
+	int ncores;
+} bench;
+
+static void bench_copy(memaddr_t i, memaddr_t n)
+{
+	memaddr_t e = i + n;
+
+	for ( ; i < e; i++ )
+		bench.c[i] = bench.a[i];
+}
+
+static void bench_scale(memaddr_t i, memaddr_t n)
+{
+	memaddr_t e = i + n;
+
+	for ( ; i < e; i++ )
+		bench.b[i] = 3.0 * bench.c[i];
+}
+
+static void bench_add(memaddr_t i, memaddr_t n)
+{
+	memaddr_t e = i + n;
+
+	for ( ; i < e; i++ )
+		bench.c[i] = bench.a[i] + bench.b[i];
+}
+
+static void bench_triad(memaddr_t i, memaddr_t n)
+{
+	memaddr_t e = i + n;
+
+	for ( ; i < e; i++ )
+		bench.a[i] = bench.b[i] + 3.0 * bench.c[i];
+}
+
+static void bench_init(memaddr_t i, memaddr_t n)
+{
+	memaddr_t e = i + n;
+
+	for ( ; i < e; i++ )
+	{
+		bench.a[i] = 1.0;
+		bench.b[i] = 2.0;
+		bench.c[i] = 0.0;
+	}
+}
+
+#define bench_node(i)	((memaddr_t *)mon_memptr(bench.base + (i) * bench.stride))
+
+/* bench_chain() - link the nodes i to i+n-1 into a single random cycle
+ *
+ * Each node holds the address of the next one.
+*/
+static void bench_chain(memaddr_t i, memaddr_t n)
+{
+	memaddr_t k, j, t;
+	uint32_t r = (uint32_t)i * 2654435761u + 1;
+
+	for ( k = 0; k < n; k++ )
+		*bench_node(i + k) = k;
+
+	for ( k = n - 1; k > 0; k-- )
+	{
+		r ^= r << 13;
+		r ^= r >> 17;
+		r ^= r << 5;
+		j = r % k;
+		t = *bench_node(i + k);
+		*bench_node(i + k) = *bench_node(i + j);
+		*bench_node(i + j) = t;
+	}
+
+	for ( k = 0; k < n; k++ )
+		*bench_node(i + k) = bench.base + (i + *bench_node(i + k)) * bench.stride;
+}
+
+static void bench_chase(memaddr_t i, memaddr_t n)
+{
+	volatile memaddr_t *p = bench_node(i);
+	long k;
+
+	for ( k = 0; k < BENCH_CHASE_STEPS; k++ )
+		p = (volatile memaddr_t *)mon_memptr(*p);
+
+	/* Make sure the chase isn't optimised away */
+	if ( p == NULL )
+		m_printf("?\n");
+}
+
+/* bench_time() - run fn over n elements; return the time in ticks
+*/
+static uint64_t bench_time(rangefunc_t fn, memaddr_t n)
+{
+	uint64_t t0 = bench_ticks();
+
+	mon_parallel_cores(fn, 0, n, bench.ncores);
+	return bench_ticks() - t0;
+}
+
+static void bench_report(const char *name, uint64_t bytes, uint64_t best, uint64_t freq)
+{
+	if ( best == 0 )
+		best = 1;
+	m_printf("    %-8s %8lu MB/s\n", name, bytes * freq / best / 1000000);
+}
+
+/* mon_bench() - run the benchmark over the range a .. a+l
+*/
+void mon_bench(memaddr_t a, memaddr_t l, memaddr_t stride, int ncores)
+{
+	static const struct
+	{
+		const char *name;
+		rangefunc_t fn;
+		int bytes;
+	} kernels[4] =
+	{
+		{ "Copy",	bench_copy,		16 },
+		{ "Scale",	bench_scale,	16 },
+		{ "Add",	bench_add,		24 },
+		{ "Triad",	bench_triad,	24 }
+	};
+	uint64_t freq = bench_freq();
+	uint64_t t, best, ns;
+	memaddr_t n, nodes, skip;
+	int i, k, used;
+
+	/* Start on a cache line; the bytes skipped come off the length. The arrays are used
+	 * through plain pointers, so the range must be reachable in one piece (mon_memspan()).
+	*/
+	skip = ((a + 63) & ~(memaddr_t)63) - a;
+	if ( l < skip )
+		l = 0;
+	else
+	{
+		a += skip;
+		l = mon_memspan(a, l - skip);
+	}
+
+	n = (l / 3 / sizeof(double)) & ~(memaddr_t)63;
+	if ( n == 0 || stride < sizeof(memaddr_t) )
+	{
+		m_printf("Range or stride too small\n");
+		return;
+	}
+
+	bench.a = (double *)mon_memptr(a);
+	bench.b = (double *)mon_memptr(a + n * sizeof(double));
+	bench.c = (double *)mon_memptr(a + 2 * n * sizeof(double));
+	bench.ncores = ncores;
+
+	used = mon_parallel_cores(bench_init, 0, n, ncores);
+	m_printf("Bandwidth: 3 arrays of %lu KiB, %d core%s\n", n * sizeof(double) / 1024, used, (used == 1) ? "" : "s");
+
+	for ( k = 0; k < 4; k++ )
+	{
+		best = ~(uint64_t)0;
+		for ( i = 0; i < BENCH_NTIMES; i++ )
+		{
+			t = bench_time(kernels[k].fn, n);
+			if ( t < best )
+				best = t;
+		}
+		bench_report(kernels[k].name, (uint64_t)n * kernels[k].bytes, best, freq);
+	}
+
+	/* The chase needs at least a few nodes per core.
+	*/
+	bench.base = a;
+	bench.stride = stride & ~(memaddr_t)(sizeof(memaddr_t) - 1);
+	nodes = l / bench.stride;
+	if ( nodes < 64 * (memaddr_t)ncores )
+	{
+		m_printf("Range too small for the latency test\n");
+		return;
+	}
+
+	mon_parallel_cores(bench_chain, 0, nodes, ncores);
+	t = bench_time(bench_chase, nodes);
+
+	ns = t * 1000000000 / freq;
+	m_printf("Latency: %lu nodes, stride %lu: %lu.%lu ns/access\n", nodes, bench.stride,
+				ns / BENCH_CHASE_STEPS, (ns * 10 / BENCH_CHASE_STEPS) % 10);
+}
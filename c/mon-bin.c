@@ -0,0 +1,191 @@
+/*	mon-bin.c - monitor binary download handling
+ *
+ *	Copyright 2020 David Haworth
+ *
+ *	This file is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2, or (at your option)
+ *	any later version.
+ *
+ *	It is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; see the file COPYING.  If not, write to
+ *	the Free Software Foundation, 59 Temple Place - Suite 330,
+ *	Boston, MA 02111-1307, USA.
+ *
+ *
+ *	This file contains the framed binary download protocol (the P command).
+ *
+ *	Each frame from the host looks like this (multi-byte fields little-endian):
+ *
+ *		SOH			start of frame
+ *		seq			sequence number, 0..255, wrapping
+ *		len[2]		number of data bytes, 0..MON_BIN_MAXDATA
+ *		addr[8]		target address of the first data byte
+ *		data[len]
+ *		crc[4]		CRC-32 (IEEE) of seq, len, addr and data
+ *
+ *	The monitor answers each frame with two bytes:
+ *		ACK seq		frame received and written to memory
+ *		NAK seq		frame damaged (seq might be damaged too)
+ *
+ *	The host can have up to MON_BIN_WINDOW frames outstanding. It resends only the
+ *	frames that are NAKed or not ACKed within its own timeout. Frames carry their own
+ *	target address, so they can be written in any order and nothing needs to be
+ *	buffered on the target. A repeated frame (e.g. after a lost ACK) is ACKed again
+ *	but not counted twice.
+ *
+ *	A frame with len == 0 ends the transfer. Two CANs between frames abort it.
+ *	If a frame would overwrite the monitor, the monitor replies CAN CAN and aborts.
+ *	The transfer is also abandoned if the host is silent for MON_BIN_IDLE_TIMEOUT.
+*/
+#include "monitor.h"
+#include "mon-stdio.h"
+
+#define MON_BIN_MAXDATA			1024
+#define MON_BIN_WINDOW			64			/* Must be <= 128 for the duplicate check */
+#define MON_BIN_HDRLEN			11			/* seq, len, addr */
+#define MON_BIN_BYTE_TIMEOUT	500000		/* 0.5 s within a frame */
+#define MON_BIN_IDLE_TIMEOUT	30000000	/* 30 s between frames */
+
+static uint8_t frame[MON_BIN_HDRLEN + MON_BIN_MAXDATA + 4];
+static uint8_t seen[256/8];
+
+static uint32_t get_le(const uint8_t *p, int n)
+{
+	uint32_t v = 0;
+
+	while ( n > 0 )
+	{
+		n--;
+		v = (v << 8) | p[n];
+	}
+	return v;
+}
+
+/* bin_read() - read n bytes of a frame
+ *
+ * Returns 0 if OK, -1 if the host stopped sending in the middle of a frame.
+*/
+static int bin_read(uint8_t *p, int n)
+{
+	int c;
+
+	while ( n > 0 )
+	{
+		c = m_readchar_timeout(MON_BIN_BYTE_TIMEOUT);
+		if ( c < 0 )
+			return -1;
+		*p++ = (uint8_t)c;
+		n--;
+	}
+	return 0;
+}
+
+static void bin_reply(uint8_t r, uint8_t seq)
+{
+	m_writechar(r);
+	m_writechar(seq);
+}
+
+/* The duplicate check. Frame seq can only be repeated while it's inside the host's
+ * window, so by the time seq+128 arrives, seq's mark can be forgotten.
+*/
+static int bin_seen(uint8_t seq)
+{
+	uint8_t old = (uint8_t)(seq + 128);
+	int was_seen = (seen[seq/8] >> (seq%8)) & 1;
+
+	seen[seq/8] |= 1 << (seq%8);
+	seen[old/8] &= ~(1 << (old%8));
+
+	return was_seen;
+}
+
+/* bin_download
+ *
+ * Parameters:
+ *
+ *	_sink  - a function to write a block of memory (see process_s_record())
+ *
+ * Return codes:
+ *	BIN_EOF		- end-of-transfer frame received
+ *	BIN_TIMEOUT	- host went quiet
+ *	BIN_CANCEL	- host cancelled the transfer
+ *	BIN_BADADDR	- a frame would overwrite the monitor
+*/
+int bin_download(sinkfunc_t _sink)
+{
+	int c, i, len;
+	int ncan = 0;
+	uint8_t seq;
+	memaddr_t addr;
+	uint8_t *data = &frame[MON_BIN_HDRLEN];
+
+	good_count = bad_count = 0;
+	mon_stats_begin(m_rx_count);
+	for ( i = 0; i < (int)sizeof(seen); i++ )
+		seen[i] = 0;
+
+	for (;;)
+	{
+		c = m_readchar_timeout(MON_BIN_IDLE_TIMEOUT);
+		if ( c < 0 )
+			return BIN_TIMEOUT;
+
+		if ( c == CAN )
+		{
+			if ( ++ncan >= 2 )
+				return BIN_CANCEL;
+			continue;
+		}
+		ncan = 0;
+
+		if ( c != SOH )
+			continue;		/* Hunt for the start of a frame */
+
+		if ( bin_read(frame, MON_BIN_HDRLEN) != 0 )
+		{
+			bad_count++;
+			continue;
+		}
+		seq = frame[0];
+		len = (int)get_le(&frame[1], 2);
+
+		if ( len > MON_BIN_MAXDATA ||
+			 bin_read(data, len + 4) != 0 ||
+			 m_crc32(0, frame, MON_BIN_HDRLEN + len) != get_le(&data[len], 4) )
+		{
+			bad_count++;
+			bin_reply(NAK, seq);
+			continue;
+		}
+
+		if ( len == 0 )
+		{
+			bin_reply(ACK, seq);
+			return BIN_EOF;
+		}
+
+		if ( !bin_seen(seq) )
+		{
+			addr = (memaddr_t)get_le(&frame[3], 4);
+#if MON_64BIT
+			addr |= (memaddr_t)get_le(&frame[7], 4) << 32;
+#endif
+			if ( _sink(addr, data, len) != 0 )
+			{
+				bad_count++;
+				bin_reply(CAN, CAN);
+				return BIN_BADADDR;
+			}
+			good_count++;
+			mon_stats_record(len);
+		}
+		bin_reply(ACK, seq);
+	}
+}
@@ -0,0 +1,360 @@
+/*	mon-elf.c - monitor streaming ELF loader
+ *
+ *	Copyright 2020 David Haworth
+ *
+ *	This file is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2, or (at your option)
+ *	any later version.
+ *
+ *	It is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; see the file COPYING.  If not, write to
+ *	the Free Software Foundation, 59 Temple Place - Suite 330,
+ *	Boston, MA 02111-1307, USA.
+ *
+ *
+ *	This file contains a loader for ELF executables, for use as a stage after a
+ *	download protocol. The ELF file is consumed in order, in pieces of any size,
+ *	so the file itself is never stored on the target.
+ *
+ *	Only the PT_LOAD segments are written, to their physical addresses (p_paddr).
+ *	The part of a segment that isn't in the file (p_memsz > p_filesz, i.e. the bss)
+ *	is cleared on the target. Everything else in the file (section headers, symbols,
+ *	debug information etc.) is skipped.
+ *
+ *	The file up to the end of the program headers is kept in elf.buf. GNU ld usually
+ *	puts the ELF header and the program headers at the start of the first segment;
+ *	that part of the segment is written from elf.buf once the headers are complete.
+ *
+ *	Limitations:
+ *		- little-endian executables for the monitor's own architecture only
+ *		- the program headers must end within the first ELF_HEADMAX bytes of the file
+ *		- at most ELF_MAXPH program headers
+*/
+#include "monitor.h"
+
+#define ELF_MAXPH		16
+#define ELF_ZEROBUF		64
+
+#define EI_CLASS		4
+#define EI_DATA			5
+#define ELFCLASS32		1
+#define ELFCLASS64		2
+#define ELFDATA2LSB		1
+#define ET_EXEC			2
+#define PT_LOAD			1
+
+#if MON_64BIT
+#define ELF_CLASS		ELFCLASS64
+#define ELF_MACHINE		183			/* EM_AARCH64 */
+#define ELF_EHSIZE		64
+#define ELF_PHSIZE		56
+#else
+#define ELF_CLASS		ELFCLASS32
+#define ELF_MACHINE		40			/* EM_ARM */
+#define ELF_EHSIZE		52
+#define ELF_PHSIZE		32
+#endif
+
+#define ELF_HEADMAX		(ELF_EHSIZE + ELF_MAXPH * ELF_PHSIZE)
+
+enum elf_state_e
+{
+	ELF_HDR,			/* Collecting the ELF header */
+	ELF_PHDR,			/* Collecting the program headers */
+	ELF_DATA,			/* Loading segments */
+	ELF_DONE,			/* All segments loaded; the rest of the file is ignored */
+	ELF_FAILED
+};
+
+struct elf_seg_s
+{
+	unsigned long offset;
+	unsigned long filesz;
+	unsigned long memsz;
+	memaddr_t paddr;
+};
+
+static struct
+{
+	enum elf_state_e state;
+	int error;
+	sinkfunc_t sink;
+	unsigned long pos;			/* Offset in the file of the next input byte */
+	unsigned long phoff;
+	int phnum;
+	int nseg;
+	int cur;					/* Segment being loaded */
+	memaddr_t entry;
+	unsigned long total;		/* Bytes of memory loaded or cleared */
+	struct elf_seg_s seg[ELF_MAXPH];
+	uint8_t buf[ELF_HEADMAX];	/* The file up to the end of the program headers */
+} elf;
+
+static const uint8_t elf_zeros[ELF_ZEROBUF];
+
+/* elf_get() - get a little-endian field of n bytes
+*/
+static maxword_t elf_get(const uint8_t *p, int n)
+{
+	maxword_t v = 0;
+
+	while ( n > 0 )
+	{
+		n--;
+		v = (v << 8) | p[n];
+	}
+	return v;
+}
+
+static int elf_fail(int e)
+{
+	elf.state = ELF_FAILED;
+	elf.error = e;
+	return -1;
+}
+
+void elf_init(sinkfunc_t _sink)
+{
+	elf.state = ELF_HDR;
+	elf.error = ELF_INCOMPLETE;
+	elf.sink = _sink;
+	elf.pos = 0;
+	elf.total = 0;
+}
+
+/* elf_header() - check the ELF header and note where the program headers are
+*/
+static int elf_header(void)
+{
+	const uint8_t *h = elf.buf;
+
+	if ( h[0] != 0x7f || h[1] != 'E' || h[2] != 'L' || h[3] != 'F' ||
+		 h[EI_CLASS] != ELF_CLASS || h[EI_DATA] != ELFDATA2LSB ||
+		 elf_get(&h[16], 2) != ET_EXEC || elf_get(&h[18], 2) != ELF_MACHINE )
+		return elf_fail(ELF_BADHDR);
+
+#if MON_64BIT
+	elf.entry = (memaddr_t)elf_get(&h[24], 8);
+	elf.phoff = (unsigned long)elf_get(&h[32], 8);
+	elf.phnum = (int)elf_get(&h[56], 2);
+	if ( elf_get(&h[54], 2) != ELF_PHSIZE )
+		return elf_fail(ELF_BADPH);
+#else
+	elf.entry = (memaddr_t)elf_get(&h[24], 4);
+	elf.phoff = (unsigned long)elf_get(&h[28], 4);
+	elf.phnum = (int)elf_get(&h[44], 2);
+	if ( elf_get(&h[42], 2) != ELF_PHSIZE )
+		return elf_fail(ELF_BADPH);
+#endif
+
+	if ( elf.phnum <= 0 || elf.phnum > ELF_MAXPH || elf.phoff < ELF_EHSIZE ||
+		 elf.phoff + elf.phnum * ELF_PHSIZE > ELF_HEADMAX )
+		return elf_fail(ELF_BADPH);
+
+	return 0;
+}
+
+/* elf_phdrs() - make a list of the PT_LOAD segments, in file order
+ *
+ * The part of each segment that lies in the headers is written straight away.
+*/
+static int elf_phdrs(void)
+{
+	const uint8_t *ph;
+	struct elf_seg_s s;
+	unsigned long end = elf.phoff + elf.phnum * ELF_PHSIZE;
+	unsigned long k;
+	int i, j;
+
+	elf.nseg = 0;
+	for ( i = 0; i < elf.phnum; i++ )
+	{
+		ph = &elf.buf[elf.phoff + i * ELF_PHSIZE];
+		if ( elf_get(&ph[0], 4) != PT_LOAD )
+			continue;
+
+#if MON_64BIT
+		s.offset = (unsigned long)elf_get(&ph[8], 8);
+		s.paddr = (memaddr_t)elf_get(&ph[24], 8);
+		s.filesz = (unsigned long)elf_get(&ph[32], 8);
+		s.memsz = (unsigned long)elf_get(&ph[40], 8);
+#else
+		s.offset = (unsigned long)elf_get(&ph[4], 4);
+		s.paddr = (memaddr_t)elf_get(&ph[12], 4);
+		s.filesz = (unsigned long)elf_get(&ph[16], 4);
+		s.memsz = (unsigned long)elf_get(&ph[20], 4);
+#endif
+		if ( s.memsz < s.filesz )
+			return elf_fail(ELF_BADPH);
+
+		/* A segment with no file data (e.g. a separate bss) doesn't need a place
+		 * in the file; put it where it won't hold up the others.
+		*/
+		if ( s.filesz == 0 )
+			s.offset = end;
+
+		/* Insertion sort by offset
+		*/
+		j = elf.nseg;
+		while ( j > 0 && elf.seg[j-1].offset > s.offset )
+		{
+			elf.seg[j] = elf.seg[j-1];
+			j--;
+		}
+		elf.seg[j] = s;
+		elf.nseg++;
+	}
+
+	for ( i = 1; i < elf.nseg; i++ )
+	{
+		if ( elf.seg[i-1].filesz != 0 &&
+			 elf.seg[i-1].offset + elf.seg[i-1].filesz > elf.seg[i].offset )
+			return elf_fail(ELF_BADPH);		/* Overlapping segments */
+	}
+
+	for ( i = 0; i < elf.nseg && elf.seg[i].offset < end; i++ )
+	{
+		k = end - elf.seg[i].offset;
+		if ( k > elf.seg[i].filesz )
+			k = elf.seg[i].filesz;
+		if ( k > 0 && elf.sink(elf.seg[i].paddr, &elf.buf[elf.seg[i].offset], (int)k) != 0 )
+			return elf_fail(ELF_BADADDR);
+	}
+
+	elf.cur = 0;
+	return 0;
+}
+
+/* elf_clear() - clear n bytes of target memory at a
+*/
+static int elf_clear(memaddr_t a, unsigned long n)
+{
+	int k;
+
+	while ( n > 0 )
+	{
+		k = ( n > ELF_ZEROBUF ) ? ELF_ZEROBUF : (int)n;
+		if ( elf.sink(a, elf_zeros, k) != 0 )
+			return -1;
+		a += k;
+		n -= k;
+	}
+	return 0;
+}
+
+/* elf_next() - finish the segments whose data is complete at the current position
+ *
+ * The bss part of each finished segment is cleared here.
+*/
+static int elf_next(void)
+{
+	struct elf_seg_s *s;
+
+	while ( elf.cur < elf.nseg )
+	{
+		s = &elf.seg[elf.cur];
+		if ( elf.pos < s->offset + s->filesz )
+			return 0;
+
+		if ( elf_clear(s->paddr + s->filesz, s->memsz - s->filesz) != 0 )
+			return elf_fail(ELF_BADADDR);
+		elf.total += s->memsz;
+		elf.cur++;
+	}
+
+	elf.state = ELF_DONE;
+	return 0;
+}
+
+/* elf_stream() - consume the next n bytes of the ELF file (a streamfunc_t)
+ *
+ * Returns 0 if OK, -1 if the file can't be loaded. The reason is returned by elf_finish().
+*/
+int elf_stream(const uint8_t *p, int n)
+{
+	struct elf_seg_s *s;
+	unsigned long k, end;
+
+	while ( n > 0 )
+	{
+		switch ( elf.state )
+		{
+		case ELF_HDR:
+			elf.buf[elf.pos] = *p++;
+			elf.pos++;
+			n--;
+			if ( elf.pos == ELF_EHSIZE && elf_header() != 0 )
+				return -1;
+			if ( elf.pos == ELF_EHSIZE )
+				elf.state = ELF_PHDR;
+			break;
+
+		case ELF_PHDR:
+			elf.buf[elf.pos] = *p++;
+			elf.pos++;
+			n--;
+			if ( elf.pos == elf.phoff + elf.phnum * ELF_PHSIZE )
+			{
+				if ( elf_phdrs() != 0 )
+					return -1;
+				elf.state = ELF_DATA;
+				if ( elf_next() != 0 )
+					return -1;
+			}
+			break;
+
+		case ELF_DATA:
+			s = &elf.seg[elf.cur];
+			end = s->offset + s->filesz;
+			if ( elf.pos < s->offset )
+			{
+				/* Skip up to the start of the segment
+				*/
+				k = s->offset - elf.pos;
+				if ( k > (unsigned long)n )
+					k = n;
+			}
+			else
+			{
+				k = end - elf.pos;
+				if ( k > (unsigned long)n )
+					k = n;
+				if ( elf.sink(s->paddr + (elf.pos - s->offset), p, (int)k) != 0 )
+					return elf_fail(ELF_BADADDR);
+			}
+			p += k;
+			n -= k;
+			elf.pos += k;
+			if ( elf_next() != 0 )
+				return -1;
+			break;
+
+		case ELF_DONE:
+			return 0;
+
+		case ELF_FAILED:
+		default:
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* elf_finish() - check that the load is complete
+ *
+ * Returns the number of bytes of memory loaded or cleared, and the entry address in *entry.
+ * If the load failed, returns one of the ELF_ codes.
+*/
+long elf_finish(memaddr_t *entry)
+{
+	if ( elf.state != ELF_DONE )
+		return elf.error;
+	*entry = elf.entry;
+	return (long)elf.total;
+}
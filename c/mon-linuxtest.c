@@ -0,0 +1,260 @@
+/*	mon-linuxtest.c - linux host test board for monitor
+ *
+ *	Copyright 2020 David Haworth
+ *
+ *	This file is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2, or (at your option)
+ *	any later version.
+ *
+ *	It is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; see the file COPYING.  If not, write to
+ *	the Free Software Foundation, 59 Temple Place - Suite 330,
+ *	Boston, MA 02111-1307, USA.
+ *
+ *
+ *	This file runs the monitor as an ordinary linux process, so that the command
+ *	and download paths can be exercised and timed without a Pi on the bench.
+ *
+ *	Usage:
+ *		monitor-linuxtest [-p]
+ *
+ *		-p	create a pseudo-terminal and use it as the console. The name of the
+ *			slave device is printed on stderr. Connect a terminal program or a
+ *			download script to it.
+ *
+ *	Without -p the console is stdin/stdout, so a download can be timed with e.g.
+ *		bin/linuxtest/monitor-linuxtest < image.srec > /dev/null
+ *	When the input reaches EOF a throughput summary is printed on stderr.
+ *
+ *	Target memory is a 512 MiB anonymous mapping. Addresses wrap modulo the size
+ *	of the mapping, so nothing that the monitor is asked to do can crash the host.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/mman.h>
+
+#include "monitor.h"
+#include "mon-stdio.h"
+
+#define LT_BUFSIZE	65536
+
+uint8_t *linuxtest_ram;
+
+static int fd_in = 0;
+static int fd_out = 1;
+
+static uint8_t rxbuf[LT_BUFSIZE];
+static int rx_pos, rx_len;
+static uint8_t txbuf[LT_BUFSIZE];
+static int tx_len;
+
+static unsigned long rx_total, tx_total;
+static struct timespec t_first;
+
+void linuxtest_flush(void)
+{
+	int i = 0;
+	int n;
+
+	while ( i < tx_len )
+	{
+		n = write(fd_out, &txbuf[i], tx_len - i);
+		if ( n <= 0 )
+			break;
+		i += n;
+	}
+	tx_total += tx_len;
+	tx_len = 0;
+}
+
+/* lt_summary() - print the throughput summary on stderr
+*/
+static void lt_summary(void)
+{
+	struct timespec t_last;
+	double elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &t_last);
+	elapsed = (t_last.tv_sec - t_first.tv_sec) + (t_last.tv_nsec - t_first.tv_nsec) / 1.0e9;
+
+	fprintf(stderr, "linuxtest: %lu bytes in, %lu bytes out, %d good, %d bad records\n",
+					rx_total, tx_total, good_count, bad_count);
+	if ( rx_total > 0 && elapsed > 0.0 )
+		fprintf(stderr, "linuxtest: %.6f s from first input byte, %.0f bytes/s in\n",
+					elapsed, rx_total / elapsed);
+}
+
+int linuxtest_getc(void)
+{
+	if ( rx_pos >= rx_len )
+	{
+		/* Make sure any pending output (prompt, echo) is visible before waiting.
+		*/
+		linuxtest_flush();
+
+		rx_len = read(fd_in, rxbuf, LT_BUFSIZE);
+		rx_pos = 0;
+		if ( rx_len <= 0 )
+		{
+			lt_summary();
+			exit(0);
+		}
+		if ( rx_total == 0 )
+			clock_gettime(CLOCK_MONOTONIC, &t_first);
+		rx_total += rx_len;
+	}
+	return rxbuf[rx_pos++];
+}
+
+int linuxtest_putc(int c)
+{
+	txbuf[tx_len++] = (uint8_t)c;
+	if ( tx_len >= LT_BUFSIZE )
+		linuxtest_flush();
+	return 1;
+}
+
+int linuxtest_rxready(void)
+{
+	struct pollfd pfd;
+
+	if ( rx_pos < rx_len )
+		return 1;
+
+	linuxtest_flush();
+	pfd.fd = fd_in;
+	pfd.events = POLLIN;
+	return ( poll(&pfd, 1, 0) > 0 );
+}
+
+/* The baud rate and flow control of a pipe or pty don't mean anything, so every setting is accepted.
+*/
+int linuxtest_setbaud(uint32_t baud)
+{
+	linuxtest_flush();
+	return 0;
+}
+
+int linuxtest_setflow(int level)
+{
+	linuxtest_flush();
+	return 0;
+}
+
+uint32_t linuxtest_time_us(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint32_t)(t.tv_sec * 1000000 + t.tv_nsec / 1000);
+}
+
+/* There's only one core in the simulation, and target code can't be called.
+*/
+void release(int c, memaddr_t a)
+{
+	m_printf("Core %d is not simulated\n", c);
+}
+
+/* With only one core, large operations are done in one piece.
+*/
+void mon_parallel(rangefunc_t fn, memaddr_t a, memaddr_t n)
+{
+	fn(a, n);
+}
+
+int mon_parallel_cores(rangefunc_t fn, memaddr_t a, memaddr_t n, int max)
+{
+	fn(a, n);
+	return 1;
+}
+
+/* The monitor isn't in the simulated memory, so "low memory" is all of it.
+ * Giving the pages back to the kernel is quicker than writing zeros to them.
+*/
+void mon_clear_low(void)
+{
+	m_printf("... clearing simulated memory\n");
+	madvise(linuxtest_ram, LINUXTEST_RAMSIZE, MADV_DONTNEED);
+}
+
+void linuxtest_go(memaddr_t a)
+{
+	m_printf("Cannot call 0x%lx in the simulation\n", a);
+}
+
+/* lt_openpty() - create a pseudo-terminal for the console
+ *
+ * The slave side is put into raw mode and kept open so that clients can come and go.
+*/
+static int lt_openpty(void)
+{
+	int master, slave;
+	char *name;
+	struct termios tio;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if ( master < 0 || grantpt(master) != 0 || unlockpt(master) != 0 || (name = ptsname(master)) == NULL )
+	{
+		perror("linuxtest: cannot create pty");
+		return -1;
+	}
+
+	slave = open(name, O_RDWR | O_NOCTTY);
+	if ( slave < 0 || tcgetattr(slave, &tio) != 0 )
+	{
+		perror("linuxtest: cannot open pty slave");
+		return -1;
+	}
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+
+	fprintf(stderr, "linuxtest: console is %s\n", name);
+	return master;
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	for ( i = 1; i < argc; i++ )
+	{
+		if ( strcmp(argv[i], "-p") == 0 )
+		{
+			fd_in = fd_out = lt_openpty();
+			if ( fd_in < 0 )
+				return 1;
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [-p]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	linuxtest_ram = mmap(NULL, LINUXTEST_RAMSIZE, PROT_READ | PROT_WRITE,
+							MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if ( linuxtest_ram == MAP_FAILED )
+	{
+		perror("linuxtest: cannot map simulated RAM");
+		return 1;
+	}
+
+	m_printf("Davros monitor version 0.6 (linux test)\n");
+	monitor("mon > ");
+
+	return 0;
+}
@@ -0,0 +1,487 @@
+/*	mon-lz4.c - monitor streaming LZ4 decompression
+ *
+ *	Copyright 2020 David Haworth
+ *
+ *	This file is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2, or (at your option)
+ *	any later version.
+ *
+ *	It is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; see the file COPYING.  If not, write to
+ *	the Free Software Foundation, 59 Temple Place - Suite 330,
+ *	Boston, MA 02111-1307, USA.
+ *
+ *
+ *	This file contains a decoder for the LZ4 frame format (as written by "lz4 file"),
+ *	for use as a stage between a download protocol and memory.
+ *
+ *	The input can arrive in pieces of any size. The output is written directly to
+ *	target memory, and matches are copied from the output that has already been
+ *	written, so the "window" is the target memory itself and the decoder needs no
+ *	buffer of its own. Runs of literals are passed to the sink as one block; matches
+ *	are copied in blocks of up to LZ4_COPYBUF bytes.
+ *
+ *	Block and content checksums are skipped, not checked; the download protocol
+ *	already protects the data on the wire. Dictionaries and skippable frames
+ *	are not supported.
+ *
+ *	There's also a simple compressor for single LZ4 blocks (lz4_compress()), for the
+ *	upload command.
+*/
+#include "monitor.h"
+
+#define LZ4_MAGIC		0x184d2204
+
+#define LZ4_FLG_BCHECK	0x10
+#define LZ4_FLG_CSIZE	0x08
+#define LZ4_FLG_CCHECK	0x04
+#define LZ4_FLG_DICTID	0x01
+
+#define LZ4_COPYBUF		64
+
+#define LZ4_HASHBITS	9
+#define LZ4_MINMATCH	4
+#define LZ4_MFLIMIT		12			/* No match may start in the last 12 bytes of a block ... */
+#define LZ4_LASTLIT		5			/* ... or end in the last 5 */
+
+enum lz4_state_e
+{
+	LZ_MAGIC,		/* Collecting the magic number */
+	LZ_FLG,			/* Frame descriptor: FLG */
+	LZ_BD,			/* Frame descriptor: BD */
+	LZ_SKIP,		/* Skipping bytes, then go to next_state */
+	LZ_BSIZE,		/* Collecting a block size */
+	LZ_TOKEN,		/* Start of a sequence */
+	LZ_LITLEN,		/* Extra literal length bytes */
+	LZ_LITERAL,		/* Literals */
+	LZ_OFFSET,		/* Match offset */
+	LZ_MATLEN,		/* Extra match length bytes */
+	LZ_RAW,			/* Uncompressed block */
+	LZ_END,			/* Frame finished */
+	LZ_ERROR
+};
+
+static struct
+{
+	enum lz4_state_e state;
+	enum lz4_state_e next_state;
+	sinkfunc_t sink;
+	memaddr_t base;			/* Start of output */
+	memaddr_t out;			/* Next output address */
+	uint32_t acc;			/* Multi-byte field being collected */
+	int nacc;				/* Bytes collected so far */
+	int skip;				/* Bytes to skip in LZ_SKIP */
+	uint8_t flg;
+	uint32_t bremain;		/* Bytes left in current block */
+	uint32_t litlen;
+	uint32_t matlen;		/* Match length - 4 */
+} lz;
+
+void lz4_init(memaddr_t addr, sinkfunc_t _sink)
+{
+	lz.state = LZ_MAGIC;
+	lz.sink = _sink;
+	lz.base = lz.out = addr;
+	lz.acc = 0;
+	lz.nacc = 0;
+}
+
+/* lz4_collect() - collect a little-endian field of n bytes
+ *
+ * Returns 1 when the field is complete (value in lz.acc).
+*/
+static int lz4_collect(uint8_t b, int n)
+{
+	lz.acc |= (uint32_t)b << (8 * lz.nacc);
+	lz.nacc++;
+	if ( lz.nacc < n )
+		return 0;
+	lz.nacc = 0;
+	return 1;
+}
+
+static void lz4_skip(int n, enum lz4_state_e next)
+{
+	if ( n == 0 )
+		lz.state = next;
+	else
+	{
+		lz.skip = n;
+		lz.next_state = next;
+		lz.state = LZ_SKIP;
+	}
+}
+
+/* After each block, skip its checksum if there is one.
+*/
+static void lz4_end_block(void)
+{
+	lz.acc = 0;
+	lz4_skip((lz.flg & LZ4_FLG_BCHECK) ? 4 : 0, LZ_BSIZE);
+}
+
+/* lz4_write() - pass n bytes of output to the sink
+*/
+static int lz4_write(const uint8_t *p, uint32_t n)
+{
+	if ( lz.sink(lz.out, p, (int)n) != 0 )
+		return -1;
+	lz.out += n;
+	return 0;
+}
+
+/* lz4_match() - copy a match from earlier output. Overlapping copies are intended.
+ *
+ * No piece is longer than the offset, so each piece only reads output that has
+ * already been written.
+*/
+static int lz4_match(uint32_t offset, uint32_t len)
+{
+	uint8_t buf[LZ4_COPYBUF];
+	memaddr_t src;
+	uint32_t k, i;
+
+	if ( offset == 0 || offset > (lz.out - lz.base) )
+		return -1;
+
+	src = lz.out - offset;
+	while ( len > 0 )
+	{
+		k = len;
+		if ( k > offset )
+			k = offset;
+		if ( k > LZ4_COPYBUF )
+			k = LZ4_COPYBUF;
+		for ( i = 0; i < k; i++ )
+			buf[i] = peek8(src + i);
+		if ( lz4_write(buf, k) != 0 )
+			return -1;
+		src += k;
+		len -= k;
+	}
+	return 0;
+}
+
+/* lz4_run() - how many bytes of a run of length len are available now, including b
+ *
+ * 0 means that the run goes beyond the end of the block, i.e. the data is damaged.
+*/
+static uint32_t lz4_run(uint32_t len, int n)
+{
+	if ( len > lz.bremain )
+		len = lz.bremain;
+	if ( len > (uint32_t)n + 1 )
+		len = (uint32_t)n + 1;
+	return len;
+}
+
+/* lz4_stream() - decode the next n bytes of the input (a streamfunc_t)
+ *
+ * Returns 0 if OK, -1 if the input is not a valid LZ4 frame.
+*/
+int lz4_stream(const uint8_t *p, int n)
+{
+	uint8_t b;
+	uint32_t k;
+
+	while ( n > 0 )
+	{
+		b = *p++;
+		n--;
+
+		switch ( lz.state )
+		{
+		case LZ_MAGIC:
+			if ( lz4_collect(b, 4) )
+			{
+				if ( lz.acc != LZ4_MAGIC )
+				{
+					lz.state = LZ_ERROR;
+					return -1;
+				}
+				lz.state = LZ_FLG;
+			}
+			break;
+
+		case LZ_FLG:
+			lz.flg = b;
+			if ( (b & 0xc0) != 0x40 || (b & LZ4_FLG_DICTID) != 0 )
+			{
+				lz.state = LZ_ERROR;
+				return -1;
+			}
+			lz.state = LZ_BD;
+			break;
+
+		case LZ_BD:
+			/* Skip the content size (if present) and the header checksum.
+			*/
+			lz.acc = 0;
+			lz4_skip(((lz.flg & LZ4_FLG_CSIZE) ? 8 : 0) + 1, LZ_BSIZE);
+			break;
+
+		case LZ_SKIP:
+			if ( --lz.skip <= 0 )
+				lz.state = lz.next_state;
+			break;
+
+		case LZ_BSIZE:
+			if ( lz4_collect(b, 4) )
+			{
+				if ( lz.acc == 0 )
+				{
+					/* End mark. Skip the content checksum, if any.
+					*/
+					lz4_skip((lz.flg & LZ4_FLG_CCHECK) ? 4 : 0, LZ_END);
+				}
+				else
+				if ( (lz.acc & 0x80000000) != 0 )
+				{
+					lz.bremain = lz.acc & 0x7fffffff;
+					lz.state = LZ_RAW;
+				}
+				else
+				{
+					lz.bremain = lz.acc;
+					lz.state = LZ_TOKEN;
+				}
+			}
+			break;
+
+		case LZ_RAW:
+			k = lz4_run(lz.bremain, n);
+			if ( k == 0 || lz4_write(p - 1, k) != 0 )
+			{
+				lz.state = LZ_ERROR;
+				return -1;
+			}
+			p += k - 1;
+			n -= k - 1;
+			lz.bremain -= k;
+			if ( lz.bremain == 0 )
+				lz4_end_block();
+			break;
+
+		case LZ_TOKEN:
+			if ( lz.bremain == 0 )
+			{
+				lz.state = LZ_ERROR;
+				return -1;
+			}
+			lz.bremain--;
+			lz.litlen = b >> 4;
+			lz.matlen = b & 0x0f;
+			lz.acc = 0;
+			if ( lz.litlen == 15 )
+				lz.state = LZ_LITLEN;
+			else
+			if ( lz.litlen > 0 )
+				lz.state = LZ_LITERAL;
+			else
+				lz.state = LZ_OFFSET;
+			break;
+
+		case LZ_LITLEN:
+			if ( lz.bremain == 0 )
+			{
+				lz.state = LZ_ERROR;
+				return -1;
+			}
+			lz.bremain--;
+			lz.litlen += b;
+			if ( b != 255 )
+				lz.state = (lz.litlen > 0) ? LZ_LITERAL : LZ_OFFSET;
+			break;
+
+		case LZ_LITERAL:
+			k = lz4_run(lz.litlen, n);
+			if ( k == 0 || lz4_write(p - 1, k) != 0 )
+			{
+				lz.state = LZ_ERROR;
+				return -1;
+			}
+			p += k - 1;
+			n -= k - 1;
+			lz.bremain -= k;
+			lz.litlen -= k;
+			if ( lz.litlen == 0 )
+				lz.state = LZ_OFFSET;
+			break;
+
+		case LZ_OFFSET:
+			if ( lz.bremain == 0 )
+			{
+				lz.state = LZ_ERROR;
+				return -1;
+			}
+			lz.bremain--;
+			if ( lz4_collect(b, 2) )
+			{
+				if ( lz.matlen == 15 )
+					lz.state = LZ_MATLEN;
+				else
+				{
+					if ( lz4_match(lz.acc, lz.matlen + 4) != 0 )
+					{
+						lz.state = LZ_ERROR;
+						return -1;
+					}
+					lz.state = LZ_TOKEN;
+				}
+			}
+			break;
+
+		case LZ_MATLEN:
+			if ( lz.bremain == 0 )
+			{
+				lz.state = LZ_ERROR;
+				return -1;
+			}
+			lz.bremain--;
+			lz.matlen += b;
+			if ( b != 255 )
+			{
+				if ( lz4_match(lz.acc, lz.matlen + 4) != 0 )
+				{
+					lz.state = LZ_ERROR;
+					return -1;
+				}
+				lz.state = LZ_TOKEN;
+			}
+			break;
+
+		case LZ_END:
+			/* Trailing bytes (e.g. XMODEM padding) are ignored.
+			*/
+			return 0;
+
+		case LZ_ERROR:
+		default:
+			return -1;
+		}
+
+		/* The last sequence in a block has literals only, so the block can end before a token
+		 * or before an offset, but not in the middle of one. A sequence that runs past the end
+		 * of the block is caught when its next byte arrives.
+		*/
+		if ( lz.bremain == 0 &&
+			 (lz.state == LZ_TOKEN || (lz.state == LZ_OFFSET && lz.nacc == 0)) )
+			lz4_end_block();
+	}
+	return 0;
+}
+
+/* lz4_finish() - check that the frame is complete
+ *
+ * Returns the number of bytes written, or -1 if the frame was damaged or incomplete.
+*/
+long lz4_finish(void)
+{
+	if ( lz.state != LZ_END )
+		return -1;
+	return (long)(lz.out - lz.base);
+}
+
+/* The compressor
+ *
+ * Greedy, with a hash table of recent positions. Good enough to squeeze the zeros and
+ * repeated patterns out of typical memory contents, and much faster than the uart.
+*/
+static uint16_t lz4_hash[1 << LZ4_HASHBITS];		/* Position + 1, 0 for none */
+
+static uint32_t lz4_get32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* lz4_putlen() - the extra bytes of a literal or match length (len is the length - 15)
+*/
+static int lz4_putlen(uint8_t *d, int o, int len)
+{
+	while ( len >= 255 )
+	{
+		d[o++] = 255;
+		len -= 255;
+	}
+	d[o++] = (uint8_t)len;
+	return o;
+}
+
+/* lz4_sequence() - append a sequence: nlit literals, then a match (unless mlen is 0)
+ *
+ * Returns the new output length, or -1 if it would be more than max.
+*/
+static int lz4_sequence(uint8_t *d, int o, int max, const uint8_t *lit, int nlit, int offset, int mlen)
+{
+	int ml = mlen - LZ4_MINMATCH;
+	int i;
+
+	if ( o + 1 + nlit + nlit/255 + 1 + ((mlen > 0) ? (2 + ml/255 + 1) : 0) > max )
+		return -1;
+
+	d[o] = (uint8_t)(((nlit >= 15) ? 15 : nlit) << 4);
+	if ( mlen > 0 )
+		d[o] |= (uint8_t)((ml >= 15) ? 15 : ml);
+	o++;
+
+	if ( nlit >= 15 )
+		o = lz4_putlen(d, o, nlit - 15);
+	for ( i = 0; i < nlit; i++ )
+		d[o++] = lit[i];
+
+	if ( mlen > 0 )
+	{
+		d[o++] = (uint8_t)offset;
+		d[o++] = (uint8_t)(offset >> 8);
+		if ( ml >= 15 )
+			o = lz4_putlen(d, o, ml - 15);
+	}
+	return o;
+}
+
+/* lz4_compress() - compress n bytes at src to an LZ4 block (not a frame) at dst
+ *
+ * n must be less than 65535. Returns the size of the block, or -1 if it would be
+ * more than max bytes.
+*/
+int lz4_compress(const uint8_t *src, int n, uint8_t *dst, int max)
+{
+	int i = 0, anchor = 0, o = 0;
+	int ref, len, h;
+	uint32_t v;
+
+	for ( h = 0; h < (1 << LZ4_HASHBITS); h++ )
+		lz4_hash[h] = 0;
+
+	while ( i + LZ4_MFLIMIT <= n )
+	{
+		v = lz4_get32(&src[i]);
+		h = (int)((v * 2654435761u) >> (32 - LZ4_HASHBITS));
+		ref = (int)lz4_hash[h] - 1;
+		lz4_hash[h] = (uint16_t)(i + 1);
+
+		if ( ref < 0 || lz4_get32(&src[ref]) != v )
+		{
+			i++;
+			continue;
+		}
+
+		len = LZ4_MINMATCH;
+		while ( i + len < n - LZ4_LASTLIT && src[ref + len] == src[i + len] )
+			len++;
+
+		o = lz4_sequence(dst, o, max, &src[anchor], i - anchor, i - ref, len);
+		if ( o < 0 )
+			return -1;
+		i += len;
+		anchor = i;
+	}
+
+	return lz4_sequence(dst, o, max, &src[anchor], n - anchor, 0, 0);
+}
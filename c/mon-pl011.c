@@ -0,0 +1,393 @@
+/*  mon-pl011.c - PL011 uart on bcm2835 etc. (raspberry pi)
+ *
+ *  Copyright 2020 David Haworth
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "mon-pl011.h"
+#include "mon-stdio.h"
+
+#if MON_UART_IRQ
+int pl011_uart_throttled;			/* Receive interrupts off because the ring is full */
+static uint8_t rxbuf[PL011_RXBUF_SIZE];
+static uint8_t txbuf[PL011_TXBUF_SIZE];
+mon_ring_t pl011_rxring = MON_RING_INIT(rxbuf);
+mon_ring_t pl011_txring = MON_RING_INIT(txbuf);
+static uint32_t pl011_uart_imsc_rx;	/* PL011_INT_RX|PL011_INT_RT, or 0 while the pump is receiving */
+#endif
+int pl011_uart_irqmode;
+volatile int pl011_uart_txon;		/* The transmit interrupt is enabled */
+uint32_t pl011_uart_overruns;		/* Receive fifo overruns and characters dropped */
+int pl011_uart_flow;				/* RTS/CTS flow control: 0 = off, else 1..4 (see pl011_uart_setflow()) */
+int pl011_uart_pumping;				/* Set by core 0 to keep the pump running */
+int pl011_uart_pump_alive;			/* Set by the pump core while it's in pl011_uart_pump() */
+
+/* Receive fifo level for the interrupt and, with flow control, for RTS.
+*/
+static const uint8_t pl011_rxlevel[5] =
+{	PL011_IFLS_1_2, PL011_IFLS_7_8, PL011_IFLS_3_4, PL011_IFLS_1_2, PL011_IFLS_1_4	};
+
+/* pl011_uart_divisor() - calculate the baud divisor for a given rate
+ *
+ * Returns the divisor in 64ths (ibrd << 6 | fbrd), or -1 if the rate is out of range.
+ * With the fractional part, the error is always less than 1%.
+*/
+static int pl011_uart_divisor(uint32_t baud)
+{
+	uint32_t div;
+
+	if ( baud == 0 || baud > PL011_CLK/16 )
+		return -1;
+
+	div = (PL011_CLK * 4 + baud / 2) / baud;		/* Rounded */
+	if ( div < 0x40 || div > 0x3fffc0 )
+		return -1;
+
+	return (int)div;
+}
+
+/* pl011_uart_setdiv() - program the divisor and the line control
+ *
+ * The uart must be disabled. The divisor is only latched when lcrh is written.
+*/
+static void pl011_uart_setdiv(int div, uint32_t lcrh)
+{
+	pl011_uart.ibrd = (uint32_t)div >> 6;
+	pl011_uart.fbrd = (uint32_t)div & 0x3f;
+	pl011_uart.lcrh = lcrh;
+}
+
+/* pl011_uart_baudok() - returns nonzero if the rate is possible
+*/
+int pl011_uart_baudok(uint32_t baud)
+{
+	return ( pl011_uart_divisor(baud) >= 0 );
+}
+
+/* pl011_uart_setbaud() - change the baud rate
+ *
+ * Pending output is sent at the old rate first.
+ * Returns 0 if OK, -1 if the rate is not possible (nothing is changed).
+*/
+int pl011_uart_setbaud(uint32_t baud)
+{
+	int div = pl011_uart_divisor(baud);
+	uint32_t cr;
+
+	if ( div < 0 )
+		return -1;
+
+	pl011_uart_flush();
+
+	cr = pl011_uart.cr;
+	pl011_uart.cr = 0;
+	pl011_uart_setdiv(div, pl011_uart.lcrh);
+	pl011_uart.cr = cr;
+
+	return 0;
+}
+
+/* pl011_uart_setflow() - turn RTS/CTS flow control on or off
+ *
+ * level 0 turns it off. 1 to 4 turns it on: the uart de-asserts RTS when the receive
+ * fifo is 7/8, 3/4, 1/2 or 1/4 full, and stops transmitting while CTS is de-asserted.
+ * The receive interrupt comes at the same level.
+ * Pending output is sent first.
+ * Returns 0 if OK, -1 if the level is not possible (nothing is changed).
+*/
+int pl011_uart_setflow(int level)
+{
+	uint32_t cr;
+
+	if ( level < 0 || level > 4 )
+		return -1;
+
+	pl011_uart_flush();
+
+	cr = pl011_uart.cr & ~(PL011_CR_CTSEN | PL011_CR_RTSEN);
+	pl011_uart.cr = 0;
+	pl011_uart.ifls = PL011_IFLS(pl011_rxlevel[level], PL011_IFLS_1_8);
+	if ( level == 0 )
+	{
+		bcm2835_gpio_pinconfig(16, BCM2835_pinfunc_input, BCM2835_pinpull_none);
+		bcm2835_gpio_pinconfig(17, BCM2835_pinfunc_input, BCM2835_pinpull_none);
+	}
+	else
+	{
+		/* A pull-down on CTS (asserted) lets output through if it isn't wired.
+		*/
+		bcm2835_gpio_pinconfig(16, BCM2835_pinfunc_alt3, BCM2835_pinpull_down);	/* CTS0 gpio16 */
+		bcm2835_gpio_pinconfig(17, BCM2835_pinfunc_alt3, BCM2835_pinpull_none);	/* RTS0 gpio17 */
+		cr |= PL011_CR_CTSEN | PL011_CR_RTSEN;
+	}
+	pl011_uart.cr = cr;
+	pl011_uart_flow = level;
+
+	return 0;
+}
+
+/* pl011_uart_init() - initialise the UART
+ *
+ * Initialize to the selected baud rate, parity and bits.
+ * Parity must be none (0).
+ * Bits can be 7 or 8
+*/
+void pl011_uart_init(uint32_t baud, uint32_t bits, uint32_t parity)
+{
+	int div = pl011_uart_divisor(baud);
+
+	pl011_uart.cr = 0;						/* Disabled */
+
+	if ( div >= 0 &&
+		 (bits == 7 || bits == 8) &&
+		 (parity == 0 ) )
+	{
+		pl011_uart.imsc = 0;				/* Interrupts disabled */
+		pl011_uart.icr = PL011_INT_ALL;
+		pl011_uart.dmacr = 0;
+		pl011_uart_setdiv(div, (bits==7 ? PL011_LCRH_7bit : PL011_LCRH_8bit) | PL011_LCRH_FEN);
+		pl011_uart.ifls = PL011_IFLS(pl011_rxlevel[0], PL011_IFLS_1_8);
+		pl011_uart_flow = 0;
+
+		bcm2835_gpio_pinconfig(14, BCM2835_pinfunc_alt0, BCM2835_pinpull_none);	/* Transmit pin gpio14 */
+		bcm2835_gpio_pinconfig(15, BCM2835_pinfunc_alt0, BCM2835_pinpull_none);	/* Receive pin gpio15 */
+
+		pl011_uart.cr = PL011_CR_UARTEN | PL011_CR_TXE | PL011_CR_RXE;
+	}
+}
+
+#if MON_UART_IRQ
+/* pl011_uart_imsc() - the interrupts that should be enabled now
+*/
+static inline uint32_t pl011_uart_imsc(void)
+{
+	return pl011_uart_imsc_rx | ( pl011_uart_txon ? PL011_INT_TX : 0 );
+}
+
+/* pl011_uart_irq_start() - switch the uart to interrupt-driven receive
+ *
+ * The ring buffers must be ready, i.e. the bss must have been cleared.
+*/
+void pl011_uart_irq_start(void)
+{
+	pl011_uart_irqmode = 1;
+	pl011_uart_txon = 0;
+	pl011_uart_imsc_rx = PL011_INT_RX | PL011_INT_RT;
+	pl011_uart.imsc = pl011_uart_imsc();
+	bcm2835_irq_enable(BCM2835_IRQ_UART);
+	bcm2835_cpu_irq_unmask();
+}
+
+/* pl011_uart_irq_stop() - switch the uart back to polled mode
+ *
+ * Used when handing the uart over to a loaded program. Pending output is sent first.
+ * Anything still in the receive ring is delivered after the next pl011_uart_irq_start().
+*/
+void pl011_uart_irq_stop(void)
+{
+	pl011_uart_flush();
+	bcm2835_cpu_irq_mask();
+	bcm2835_irq_disable(BCM2835_IRQ_UART);
+	pl011_uart.imsc = 0;
+	pl011_uart_irqmode = 0;
+}
+
+/* pl011_uart_fill() - move characters from the transmit ring to the fifo
+ *
+ * Turns the transmit interrupt off when the ring is empty. Interrupts must be masked.
+*/
+static void pl011_uart_fill(void)
+{
+	while ( mon_ring_count(&pl011_txring) > 0 && pl011_uart_istx() )
+	{
+		pl011_uart.dr = mon_ring_get(&pl011_txring);
+	}
+	pl011_uart_txon = ( mon_ring_count(&pl011_txring) != 0 );
+	pl011_uart.imsc = pl011_uart_imsc();
+}
+
+/* pl011_uart_txstart() - start transmitting from the ring (on core 0)
+*/
+void pl011_uart_txstart(void)
+{
+	bcm2835_cpu_irq_mask();
+	pl011_uart_fill();
+	bcm2835_cpu_irq_unmask();
+}
+
+/* pl011_uart_irq() - uart interrupt handler
+ *
+ * Empties the receive fifo into the ring buffer. If the ring buffer is full the
+ * character is dropped (and counted), unless there's flow control: then the receive
+ * interrupts are turned off until pl011_uart_unthrottle(), and RTS holds the host off.
+ *
+ * Fills the transmit fifo from the ring buffer.
+*/
+void pl011_uart_irq(void)
+{
+	uint32_t d;
+
+	pl011_uart.icr = PL011_INT_RX | PL011_INT_RT | PL011_INT_TX | PL011_INT_OE;
+
+	while ( pl011_uart_imsc_rx != 0 && pl011_uart_isrx() )
+	{
+		if ( pl011_uart_flow != 0 && mon_ring_space(&pl011_rxring) == 0 )
+		{
+			pl011_uart_throttled = 1;
+			pl011_uart_imsc_rx = 0;
+			pl011_uart.imsc = pl011_uart_imsc();
+			break;
+		}
+		d = pl011_uart.dr;
+		if ( (d & PL011_DR_OE) != 0 )
+			pl011_uart_overruns++;
+		if ( mon_ring_space(&pl011_rxring) > 0 )
+			mon_ring_put(&pl011_rxring, (uint8_t)d);
+		else
+			pl011_uart_overruns++;
+	}
+
+	if ( pl011_uart_txon )
+		pl011_uart_fill();
+}
+
+/* pl011_uart_unthrottle() - turn the receive interrupts on again (on core 0)
+ *
+ * As bcm2835_uart_unthrottle().
+*/
+void pl011_uart_unthrottle(void)
+{
+	if ( mon_ring_space(&pl011_rxring) < PL011_RXBUF_SIZE / 2 )
+		return;
+
+	bcm2835_cpu_irq_mask();
+	pl011_uart_throttled = 0;
+	if ( !__atomic_load_n(&pl011_uart_pumping, __ATOMIC_ACQUIRE) )
+	{
+		pl011_uart_imsc_rx = PL011_INT_RX | PL011_INT_RT;
+		pl011_uart.imsc = pl011_uart_imsc();
+	}
+	bcm2835_cpu_irq_unmask();
+}
+
+/* pl011_uart_pump_begin() - hand the receive side over to the pump (on core 0)
+ *
+ * As bcm2835_uart_pump_begin().
+*/
+void pl011_uart_pump_begin(void)
+{
+	bcm2835_cpu_irq_mask();
+	pl011_uart_imsc_rx = 0;
+	pl011_uart.imsc = pl011_uart_imsc();
+	__atomic_store_n(&pl011_uart_pumping, 1, __ATOMIC_RELEASE);
+	bcm2835_cpu_irq_unmask();
+}
+
+/* pl011_uart_pump_end() - take the receive side back from the pump (on core 0)
+ *
+ * As bcm2835_uart_pump_end().
+*/
+void pl011_uart_pump_end(void)
+{
+	bcm2835_cpu_irq_mask();
+	pl011_uart_imsc_rx = PL011_INT_RX | PL011_INT_RT;
+	pl011_uart.imsc = pl011_uart_imsc();
+	bcm2835_cpu_irq_unmask();
+}
+
+/* pl011_uart_pump() - receive loop for another core
+ *
+ * As bcm2835_uart_pump().
+*/
+int pl011_uart_pump(int core)
+{
+	uint32_t d;
+
+	__atomic_store_n(&pl011_uart_pump_alive, 1, __ATOMIC_RELEASE);
+
+	while ( __atomic_load_n(&pl011_uart_pumping, __ATOMIC_ACQUIRE) )
+	{
+		if ( pl011_uart_isrx() )
+		{
+			if ( pl011_uart_flow != 0 && mon_ring_space(&pl011_rxring) == 0 )
+				continue;		/* Leave it in the fifo; RTS holds the host off */
+			d = pl011_uart.dr;
+			if ( (d & PL011_DR_OE) != 0 )
+				pl011_uart_overruns++;
+			if ( mon_ring_space(&pl011_rxring) > 0 )
+				mon_ring_put(&pl011_rxring, (uint8_t)d);
+			else
+				pl011_uart_overruns++;
+		}
+	}
+
+	__atomic_store_n(&pl011_uart_pump_alive, 0, __ATOMIC_RELEASE);
+	return 0;
+}
+
+#else
+
+void pl011_uart_irq_start(void)
+{
+}
+
+void pl011_uart_irq_stop(void)
+{
+}
+
+void pl011_uart_irq(void)
+{
+}
+
+void pl011_uart_txstart(void)
+{
+}
+
+void pl011_uart_pump_begin(void)
+{
+}
+
+void pl011_uart_pump_end(void)
+{
+}
+
+int pl011_uart_pump(int core)
+{
+	return 0;
+}
+
+void pl011_uart_unthrottle(void)
+{
+}
+
+#endif
+
+/* pl011_uart_flush() - wait until all output has been sent
+*/
+void pl011_uart_flush(void)
+{
+#if MON_UART_IRQ
+	if ( pl011_uart_irqmode )
+	{
+		while ( mon_ring_count(&pl011_txring) != 0 )
+		{
+			/* Wait till the interrupt handler has emptied the ring */
+		}
+	}
+#endif
+	while ( (pl011_uart.fr & PL011_FR_BUSY) != 0 )
+	{
+		/* Wait till the fifo and shift register are empty */
+	}
+}
@@ -22,13 +22,66 @@
 */
 #include "monitor.h"
 
+/* On the linux test board, define MON_SREC_TRACE to get a trace of each record
+ * on stdout. It's off by default because it swamps any throughput measurement.
+*/
+#if MON_BOARD == MON_LINUXTEST && defined(MON_SREC_TRACE)
+#include <stdio.h>
+#define SREC_TRACE	1
+#else
+#define SREC_TRACE	0
+#endif
+
+/* srec_decode() - convert the hex digits of a record into binary, in one pass
+ *
+ * The first byte (the length) says how many more bytes follow. The checksum is
+ * accumulated on the way. Returns the number of bytes in srec_buf (including the length
+ * and checksum bytes), or an SREC_ error code.
+*/
+static uint8_t srec_buf[256];
+
+static int srec_decode(const char *p)
+{
+	int hi, lo;
+	int i, n;
+	unsigned ck = 0;
+
+	n = 1;
+	for ( i = 0; i < n; i++ )
+	{
+		hi = m_hexval[(uint8_t)p[0]];
+		lo = m_hexval[(uint8_t)p[1]];
+		if ( (hi | lo) < 0 )
+		{
+			if ( p[0] == '\0' || p[1] == '\0' )
+				return(SREC_BADLEN);
+			return(SREC_NONHEX);
+		}
+		srec_buf[i] = (uint8_t)((hi << 4) | lo);
+		ck += srec_buf[i];
+		p += 2;
+
+		if ( i == 0 )
+		{
+			n = srec_buf[0] + 1;
+			if ( n < 4 )
+				return(SREC_BADLEN);
+		}
+	}
+
+	if ( (ck & 0xff) != 0xff )
+		return(SREC_BADCK);
+
+	return(n);
+}
+
 /* process_s_record
  *
  * Parameters:
  *
  *	line  - contains the complete S-record. The S is in line[0],
  *			followed immediately by the type, ...
- *	p	  -	a function to poke a byte of memory. This function
+ *	_sink -	a function to write a block of memory (e.g. mon_write()). This function
  *			should be capable of programming flash if necessary.
  *
  * Return codes:
@@ -40,65 +93,53 @@
 int good_count = 0;
 int bad_count = 0;
 
-int process_s_record(char *line, pokefunc_t _poke)
+int process_s_record(char *line, sinkfunc_t _sink)
 {
-	int slen;
 	memaddr_t addr;
-	char *p;
-	int len;
-	int addrlen = 4;
-	int ck;
+	int n;
+	int addrlen = 2;
+	int payload = 0;
 	int i;
 
-	len = m_strlen(line);
-	p = &line[2];
 	switch ( line[1] )
 	{
 	case '3':
-		addrlen += 2;
+		addrlen++;
 		/* Fall through */
 	case '2':
-		addrlen += 2;
+		addrlen++;
 		/* Fall through */
 	case '1':
-#if MON_BOARD == MON_LINUXTEST
-		printf("S%c-record, len = %d\n", line[1], len);
+		n = srec_decode(&line[2]);
+#if SREC_TRACE
+		printf("S%c-record, n = %d\n", line[1], n);
 #endif
-		if ( len < 10 ||
-			 (slen = gethex(&p, 2)) < 3 ||
-			 len < 2*slen+4 )
+		if ( n < 0 )
 		{
 			bad_count++;
-			return(SREC_BADLEN);
+			return(n);
 		}
-		ck = slen;
-		for ( i=0; i<slen; i++ )
-		{
-			if ( m_isxdigit(*p) && m_isxdigit(*(p+1)) )
-				ck += gethex(&p, 2);
-			else
-			{
-				bad_count++;
-				return(SREC_NONHEX);
-			}
-		}
-		if ( (ck & 0xff) != 0xff )
+		if ( n < addrlen + 2 )
 		{
 			bad_count++;
-			return(SREC_BADCK);
+			return(SREC_BADLEN);
 		}
-		p = &line[4];
-		addr = gethex(&p, addrlen);
-#if MON_BOARD == MON_LINUXTEST
-		printf("S%c-record, addr = %04x, slen = %02x\n", line[1], addr, slen);
+
+		addr = 0;
+		for ( i = 1; i <= addrlen; i++ )
+			addr = (addr << 8) | srec_buf[i];
+#if SREC_TRACE
+		printf("S%c-record, addr = %04lx, slen = %02x\n", line[1], (unsigned long)addr, srec_buf[0]);
 #endif
-		slen -= (1 + addrlen/2);		/* Address & Checksum */
-		while ( slen > 0 )
+
+		/* The record is good. Now commit the data.
+		*/
+		if ( _sink(addr, &srec_buf[1 + addrlen], n - (2 + addrlen)) != 0 )
 		{
-			_poke(addr, gethex(&p, 2));
-			addr++;
-			slen--;
+			bad_count++;
+			return(SREC_BADADDR);
 		}
+		payload = n - (2 + addrlen);
 		break;
 
 	case '5':	/* Optional count records - ignore */
@@ -109,6 +150,7 @@ int process_s_record(char *line, pokefunc_t _poke)
 	case '8':
 	case '9':
 		good_count++;
+		mon_stats_record(0);
 		return(SREC_EOF);
 		break;
 
@@ -123,5 +165,6 @@ int process_s_record(char *line, pokefunc_t _poke)
 	}
 
 	good_count++;
+	mon_stats_record(payload);
 	return(0);
 }
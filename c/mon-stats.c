@@ -0,0 +1,108 @@
+/*	mon-stats.c - monitor download statistics
+ *
+ *	Copyright 2020 David Haworth
+ *
+ *	This file is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2, or (at your option)
+ *	any later version.
+ *
+ *	It is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; see the file COPYING.  If not, write to
+ *	the Free Software Foundation, 59 Temple Place - Suite 330,
+ *	Boston, MA 02111-1307, USA.
+ *
+ *
+ *	This file contains the timing of download sessions (S-records, P and X/L), for the
+ *	I command.
+ *
+ *	A session starts with mon_stats_begin(). Each good record or frame is timestamped by
+ *	mon_stats_record() when it has been written to memory. The rates are measured from
+ *	the first record to the last, so the time that the host takes to start sending
+ *	doesn't count; they need at least two records.
+ *
+ *	The time base is mon_time_us(): the 1 MHz system timer on the pi.
+*/
+#include "monitor.h"
+#include "mon-stdio.h"
+
+static struct
+{
+	unsigned long rx_begin;		/* Characters received before the session */
+	unsigned long rx_first;		/* ... up to the end of the first record */
+	unsigned long rx_last;		/* ... up to the end of the last record */
+	unsigned long ovr_begin;	/* Overruns before the session */
+	unsigned long ovr_last;
+	unsigned long records;
+	unsigned long payload;		/* Bytes written to memory */
+	unsigned long payload_first;
+	uint32_t t_first;			/* Time at the end of the first record */
+	uint32_t t_last;			/* Time at the end of the last record */
+	uint32_t max_gap;			/* Longest time between two records */
+} stats;
+
+/* mon_stats_begin() - start a download session
+ *
+ * rx is the value of m_rx_count before the first character of the session.
+*/
+void mon_stats_begin(unsigned long rx)
+{
+	stats.rx_begin = stats.rx_first = stats.rx_last = rx;
+	stats.ovr_begin = stats.ovr_last = mon_console_overruns();
+	stats.records = 0;
+	stats.payload = stats.payload_first = 0;
+	stats.t_first = stats.t_last = 0;
+	stats.max_gap = 0;
+}
+
+/* mon_stats_record() - a good record or frame with n bytes of payload has been processed
+*/
+void mon_stats_record(int n)
+{
+	uint32_t t = mon_time_us();
+
+	if ( stats.records == 0 )
+	{
+		stats.t_first = t;
+		stats.rx_first = m_rx_count;
+		stats.payload_first = (unsigned long)n;
+	}
+	else
+	if ( (t - stats.t_last) > stats.max_gap )
+		stats.max_gap = t - stats.t_last;
+
+	stats.t_last = t;
+	stats.rx_last = m_rx_count;
+	stats.ovr_last = mon_console_overruns();
+	stats.records++;
+	stats.payload += (unsigned long)n;
+}
+
+/* mon_stats_info() - print the statistics of the last session
+*/
+void mon_stats_info(void)
+{
+	uint64_t us = (uint64_t)(stats.t_last - stats.t_first);
+
+	m_printf("    Bytes received               : %lu\n", stats.rx_last - stats.rx_begin);
+	m_printf("    Payload bytes                : %lu\n", stats.payload);
+	m_printf("    UART overruns                : %lu (%lu since reset)\n",
+				stats.ovr_last - stats.ovr_begin, mon_console_overruns());
+
+	if ( stats.records < 2 || us == 0 )
+		return;
+
+	m_printf("    Time (first to last record)  : %lu us\n", (unsigned long)us);
+	m_printf("    Records per second           : %lu\n",
+				(unsigned long)((uint64_t)(stats.records - 1) * 1000000 / us));
+	m_printf("    Payload bytes per second     : %lu\n",
+				(unsigned long)((uint64_t)(stats.payload - stats.payload_first) * 1000000 / us));
+	m_printf("    Line bytes per second        : %lu\n",
+				(unsigned long)((uint64_t)(stats.rx_last - stats.rx_first) * 1000000 / us));
+	m_printf("    Worst gap between records    : %lu us\n", (unsigned long)stats.max_gap);
+}
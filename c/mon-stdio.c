@@ -41,6 +41,7 @@ static int isreturn(char c)
 static int m_xprintf(const char *fmt, va_list ap);
 
 int m_echo;
+unsigned long m_rx_count;		/* Characters received by m_readchar() */
 
 extern memaddr_t GetSP(void);
 
@@ -92,6 +93,32 @@ char *m_gets(char *buf, int max)
 	return(buf);
 }
 
+/* m_readchar_timeout() - read a character, waiting at most us microseconds
+ *
+ * Returns the character (0..255) or -1 on timeout.
+*/
+int m_readchar_timeout(uint32_t us)
+{
+	uint32_t t0 = mon_time_us();
+
+	while ( !mon_console_rxready() )
+	{
+		if ( (mon_time_us() - t0) >= us )
+			return -1;
+	}
+	return (int)(uint8_t)m_readchar();
+}
+
+void m_delay_us(uint32_t us)
+{
+	uint32_t t0 = mon_time_us();
+
+	while ( (mon_time_us() - t0) < us )
+	{
+		/* Wait */
+	}
+}
+
 int m_printf(char *fmt, ...)
 {
 	int n;
@@ -0,0 +1,258 @@
+/*	mon-upload.c - monitor binary upload handling
+ *
+ *	Copyright 2020 David Haworth
+ *
+ *	This file is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2, or (at your option)
+ *	any later version.
+ *
+ *	It is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; see the file COPYING.  If not, write to
+ *	the Free Software Foundation, 59 Temple Place - Suite 330,
+ *	Boston, MA 02111-1307, USA.
+ *
+ *
+ *	This file contains the framed binary upload protocol (the U command), the
+ *	opposite direction to the P command in mon-bin.c.
+ *
+ *	When the host is ready to receive it sends ACK. The monitor then sends the memory
+ *	range as a stream of frames (multi-byte fields little-endian):
+ *
+ *		SOH			start of an uncompressed frame
+ *		seq			sequence number, 0..255, wrapping
+ *		len[2]		number of data bytes, 0..MON_UP_MAXDATA
+ *		addr[8]		address of the first data byte
+ *		data[len]
+ *		crc[4]		CRC-32 (IEEE) of seq, len, addr and data
+ *
+ *	or, if compression was requested and it makes the frame smaller:
+ *
+ *		STX			start of a compressed frame
+ *		seq
+ *		len[2]		number of bytes in data
+ *		addr[8]
+ *		rawlen[2]	number of bytes of memory that data decompresses to
+ *		data[len]	an LZ4 block (not an LZ4 frame)
+ *		crc[4]		CRC-32 of seq, len, addr, rawlen and data
+ *
+ *	A SOH frame with len == 0 ends the upload; its addr is the end of the range.
+ *
+ *	The monitor doesn't wait for acknowledgements, so the upload runs at line rate.
+ *	The host checks the CRCs and fetches any damaged frames again with another U
+ *	command; each frame carries its own address, so that's easy. Two CANs from the
+ *	host stop the upload. If the host doesn't send ACK within MON_UP_START_TIMEOUT,
+ *	nothing is sent.
+ *
+ *	Block hashes (the K command) use the same frames and handshake. The data of each
+ *	SOH frame is a list of XXH64 hashes (8 bytes each, seed 0) of consecutive blocks of
+ *	memory, and addr is the address of the first of those blocks. The last block is
+ *	shorter if the range isn't a multiple of the block size. The host compares the
+ *	hashes with its own image and sends only the blocks that differ (e.g. with P).
+*/
+#include "monitor.h"
+#include "mon-stdio.h"
+
+#define MON_UP_MAXDATA			1024
+#define MON_UP_HDRLEN			11			/* seq, len, addr */
+#define MON_UP_ZHDRLEN			13			/* seq, len, addr, rawlen */
+#define MON_UP_START_TIMEOUT	10000000	/* 10 s for the host to get ready */
+
+static uint8_t up_raw[MON_UP_MAXDATA];
+static uint8_t up_z[MON_UP_MAXDATA];
+
+static void put_le(uint8_t *p, maxword_t v, int n)
+{
+	while ( n > 0 )
+	{
+		*p++ = (uint8_t)v;
+		v >>= 8;
+		n--;
+	}
+}
+
+/* up_send() - send a frame: start byte, header, data and CRC
+ *
+ * Returns the number of bytes sent.
+*/
+static long up_send(uint8_t start, const uint8_t *hdr, int nhdr, const uint8_t *data, int n)
+{
+	uint8_t crc[4];
+	int i;
+
+	put_le(crc, m_crc32(m_crc32(0, hdr, nhdr), data, n), 4);
+
+	m_writechar(start);
+	for ( i = 0; i < nhdr; i++ )
+		m_writechar(hdr[i]);
+	for ( i = 0; i < n; i++ )
+		m_writechar(data[i]);
+	for ( i = 0; i < 4; i++ )
+		m_writechar(crc[i]);
+
+	return 1 + nhdr + n + 4;
+}
+
+/* up_cancelled() - look for CAN CAN from the host, without waiting
+*/
+static int up_cancelled(int *ncan)
+{
+	while ( mon_console_rxready() )
+	{
+		if ( m_readchar() == CAN )
+		{
+			if ( ++*ncan >= 2 )
+				return 1;
+		}
+		else
+			*ncan = 0;
+	}
+	return 0;
+}
+
+/* up_start() - wait for the host to send ACK
+*/
+static long up_start(void)
+{
+	int c;
+	int ncan = 0;
+
+	do {
+		c = m_readchar_timeout(MON_UP_START_TIMEOUT);
+		if ( c < 0 )
+			return UP_TIMEOUT;
+		if ( c == CAN && ++ncan >= 2 )
+			return UP_CANCEL;
+	} while ( c != ACK );
+	return 0;
+}
+
+/* up_end() - send the end frame
+*/
+static long up_end(uint8_t seq, memaddr_t a)
+{
+	uint8_t hdr[MON_UP_HDRLEN];
+	long n;
+
+	hdr[0] = seq;
+	put_le(&hdr[1], 0, 2);
+	put_le(&hdr[3], a, 8);
+	n = up_send(SOH, hdr, MON_UP_HDRLEN, up_raw, 0);
+	m_flush();
+	return n;
+}
+
+/* bin_upload
+ *
+ * Parameters:
+ *
+ *	a	- start address
+ *	n	- number of bytes
+ *	z	- nonzero to compress the frames
+ *
+ * Return codes:
+ *	>= 0		- OK, number of bytes sent
+ *	UP_TIMEOUT	- the host didn't send ACK to start
+ *	UP_CANCEL	- the host cancelled the upload
+*/
+long bin_upload(memaddr_t a, memaddr_t n, int z)
+{
+	uint8_t hdr[MON_UP_ZHDRLEN];
+	uint8_t seq = 0;
+	int ncan = 0;
+	int i, k, zn;
+	long total;
+
+	total = up_start();
+	if ( total < 0 )
+		return total;
+
+	while ( n > 0 )
+	{
+		if ( up_cancelled(&ncan) )
+			return UP_CANCEL;
+
+		k = ( n > MON_UP_MAXDATA ) ? MON_UP_MAXDATA : (int)n;
+
+		/* Read each byte of memory once.
+		*/
+		for ( i = 0; i < k; i++ )
+			up_raw[i] = peek8(a + i);
+
+		hdr[0] = seq++;
+		put_le(&hdr[3], a, 8);
+
+		/* The compressed frame has 2 extra header bytes, so it has to save more than that.
+		*/
+		zn = z ? lz4_compress(up_raw, k, up_z, k - 3) : -1;
+		if ( zn > 0 )
+		{
+			put_le(&hdr[1], zn, 2);
+			put_le(&hdr[11], k, 2);
+			total += up_send(STX, hdr, MON_UP_ZHDRLEN, up_z, zn);
+		}
+		else
+		{
+			put_le(&hdr[1], k, 2);
+			total += up_send(SOH, hdr, MON_UP_HDRLEN, up_raw, k);
+		}
+
+		a += k;
+		n -= k;
+	}
+
+	return total + up_end(seq, a);
+}
+
+#if MON_64BIT
+/* bin_hashes
+ *
+ * Parameters:
+ *
+ *	a	- start address
+ *	n	- number of bytes
+ *	bs	- block size
+ *
+ * Return codes: as bin_upload()
+*/
+long bin_hashes(memaddr_t a, memaddr_t n, memaddr_t bs)
+{
+	uint8_t hdr[MON_UP_HDRLEN];
+	uint8_t seq = 0;
+	int ncan = 0;
+	int k;
+	memaddr_t b;
+	long total;
+
+	total = up_start();
+	if ( total < 0 )
+		return total;
+
+	while ( n > 0 )
+	{
+		if ( up_cancelled(&ncan) )
+			return UP_CANCEL;
+
+		hdr[0] = seq++;
+		put_le(&hdr[3], a, 8);
+
+		for ( k = 0; k < MON_UP_MAXDATA && n > 0; k += 8 )
+		{
+			b = ( n > bs ) ? bs : n;
+			put_le(&up_raw[k], mon_xxh64_range(a, b, 0), 8);
+			a += b;
+			n -= b;
+		}
+
+		put_le(&hdr[1], k, 2);
+		total += up_send(SOH, hdr, MON_UP_HDRLEN, up_raw, k);
+	}
+
+	return total + up_end(seq, a);
+}
+#endif
@@ -24,16 +24,135 @@
 */
 #include "monitor.h"
 
+/* m_hexval[] - value of each character as a hex digit, or -1 if it isn't one
+*/
+const signed char m_hexval[256] =
+{
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
 int char2hex(char c)
 {
-	if ( c >= '0' && c <= '9' )
-		return(c - '0');
-	if ( c >= 'A' && c <= 'F' )
-		return(c - 'A' + 10);
-	if ( c >= 'a' && c <= 'f' )
-		return(c - 'a' + 10);
-	return(-1);
+	return(m_hexval[(uint8_t)c]);
+}
+
+/* mon_write() - the standard sink for downloads
+ *
+ * Writes n bytes from p to target memory at a. The monitor's own image is checked
+ * once per block. The bulk of the block is written with aligned maxword_t stores.
+ * The source might not be aligned, so each word is assembled from bytes (little-endian).
+ *
+ * Returns 0 if OK, -1 if the block would overwrite the monitor.
+*/
+#if MON_BOARD == MON_LINUXTEST
+/* The monitor isn't in the simulated memory. */
+#define mon_overlaps(a, n)	0
+#else
+/* a + n can overflow near the top of memory on a 32-bit board, so it's never calculated.
+*/
+extern uint64_t mon_startaddr, mon_endaddr;
+#define mon_overlaps(a, n)	( (a) < (memaddr_t)&mon_endaddr && \
+							  ( (a) >= (memaddr_t)&mon_startaddr || \
+								(memaddr_t)(n) > (memaddr_t)&mon_startaddr - (a) ) )
+#endif
+
+#define WORDSIZE	((int)sizeof(maxword_t))
+
+int mon_write(memaddr_t a, const uint8_t *p, int n)
+{
+	maxword_t w;
+	int i;
+
+	if ( n <= 0 )
+		return(0);
+
+	if ( mon_overlaps(a, n) )
+		return(-1);
+
+	while ( n > 0 && (a & (WORDSIZE-1)) != 0 )
+	{
+		poke8(a, *p);
+		a++;
+		p++;
+		n--;
+	}
+
+	while ( n >= WORDSIZE )
+	{
+		w = 0;
+		for ( i = WORDSIZE-1; i >= 0; i-- )
+			w = (w << 8) | p[i];
+		*(maxword_t *)mon_memptr(a) = w;
+		a += WORDSIZE;
+		p += WORDSIZE;
+		n -= WORDSIZE;
+	}
+
+	while ( n > 0 )
+	{
+		poke8(a, *p);
+		a++;
+		p++;
+		n--;
+	}
+
+	return(0);
+}
+
+/* mon_sync_code() - make code that has been written to memory visible to instruction fetches
+ *
+ * The pi3 version (mon-arm64-cache.S) does the cache maintenance. The other boards run with
+ * the caches off, so there's nothing to do.
+*/
+#if MON_BOARD != MON_PI3_ARM64
+void mon_sync_code(void)
+{
+}
+#endif
+
+/* mon_zero() - clear n bytes of memory starting at a
+ *
+ * The pi3 has an assembly-language version (mon-arm64-zero.S) that uses DC ZVA and NEON.
+*/
+#if MON_BOARD != MON_PI3_ARM64
+void mon_zero(memaddr_t a, memaddr_t n)
+{
+	memaddr_t e = a + n;
+
+	while ( a < e && (a & (WORDSIZE-1)) != 0 )
+	{
+		poke8(a, 0);
+		a++;
+	}
+
+	while ( (e - a) >= WORDSIZE )
+	{
+		*(maxword_t *)mon_memptr(a) = 0;
+		a += WORDSIZE;
+	}
+
+	while ( a < e )
+	{
+		poke8(a, 0);
+		a++;
+	}
 }
+#endif
 
 maxword_t gethex(char **pp, int max)
 {
@@ -63,3 +182,290 @@ maxword_t gethex(char **pp, int max)
 	*pp = p;
 	return(a);
 }
+
+maxword_t getdec(char **pp, int max)
+{
+	char *p = *pp;
+	maxword_t n = 0;
+
+	if ( !m_isdigit(*p) )
+	{
+		*pp = NULL;
+		return(0);
+	}
+
+	while ( max > 0 && m_isdigit(*p) )
+	{
+		n = n * 10 + (*p - '0');
+		p++;
+		max--;
+	}
+
+	*pp = p;
+	return(n);
+}
+
+/* m_crc32() - CRC-32 (IEEE 802.3, as used by zlib, ethernet etc.)
+ *
+ * crc is the result of the previous call, or 0 to start.
+ *
+ * On the pi3 the ARMv8 CRC32 instructions (same polynomial) do the work, 8 bytes at a time
+ * once p is aligned. Elsewhere it's table-driven; the table is calculated on first use.
+*/
+#if MON_BOARD == MON_PI3_ARM64
+
+static inline uint32_t crc32b(uint32_t crc, uint8_t v)
+{
+	__asm__ ("crc32b %w0, %w0, %w1" : "+r" (crc) : "r" (v));
+	return crc;
+}
+
+static inline uint32_t crc32x(uint32_t crc, uint64_t v)
+{
+	__asm__ ("crc32x %w0, %w0, %x1" : "+r" (crc) : "r" (v));
+	return crc;
+}
+
+uint32_t m_crc32(uint32_t crc, const uint8_t *p, unsigned long n)
+{
+	crc = ~crc;
+	while ( n > 0 && ((unsigned long)p & 7) != 0 )
+	{
+		crc = crc32b(crc, *p++);
+		n--;
+	}
+	while ( n >= 8 )
+	{
+		crc = crc32x(crc, *(const uint64_t *)p);
+		p += 8;
+		n -= 8;
+	}
+	while ( n > 0 )
+	{
+		crc = crc32b(crc, *p++);
+		n--;
+	}
+	return ~crc;
+}
+
+#else
+
+static uint32_t crc32_table[256];
+
+static void crc32_init(void)
+{
+	uint32_t c;
+	int i, j;
+
+	for ( i = 0; i < 256; i++ )
+	{
+		c = (uint32_t)i;
+		for ( j = 0; j < 8; j++ )
+			c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+		crc32_table[i] = c;
+	}
+}
+
+uint32_t m_crc32(uint32_t crc, const uint8_t *p, unsigned long n)
+{
+	if ( crc32_table[1] == 0 )
+		crc32_init();
+
+	crc = ~crc;
+	while ( n > 0 )
+	{
+		crc = crc32_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		n--;
+	}
+	return ~crc;
+}
+
+#endif
+
+/* mon_crc32_range() - CRC-32 of target memory a .. a+n
+ *
+ * The range is done in pieces that mon_memptr() can reach in one go (see mon_memspan()).
+*/
+uint32_t mon_crc32_range(memaddr_t a, memaddr_t n)
+{
+	uint32_t crc = 0;
+	memaddr_t k;
+
+	while ( n > 0 )
+	{
+		k = mon_memspan(a, n);
+		crc = m_crc32(crc, (const uint8_t *)mon_memptr(a), k);
+		a += k;
+		n -= k;
+	}
+	return crc;
+}
+
+#if MON_64BIT
+/* m_xxh64() - XXH64 hash (as "xxhsum -H64" and python's xxhash.xxh64)
+ *
+ * Four independent lanes of 8 bytes, so it keeps up with memory on a 64-bit core.
+*/
+#define XXH_P1	0x9e3779b185ebca87UL
+#define XXH_P2	0xc2b2ae3d27d4eb4fUL
+#define XXH_P3	0x165667b19e3779f9UL
+#define XXH_P4	0x85ebca77c2b2ae63UL
+#define XXH_P5	0x27d4eb2f165667c5UL
+
+#define xxh_rotl(x, r)	(((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline uint32_t xxh_get32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Aligned loads where possible: the monitor might be running with the MMU off.
+*/
+static inline uint64_t xxh_get64(const uint8_t *p)
+{
+	if ( ((unsigned long)p & 7) == 0 )
+		return *(const uint64_t *)p;
+	return (uint64_t)xxh_get32(p) | ((uint64_t)xxh_get32(p + 4) << 32);
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t v)
+{
+	acc += v * XXH_P2;
+	acc = xxh_rotl(acc, 31);
+	return acc * XXH_P1;
+}
+
+static inline uint64_t xxh_merge(uint64_t h, uint64_t v)
+{
+	h ^= xxh_round(0, v);
+	return h * XXH_P1 + XXH_P4;
+}
+
+/* m_xxh64_begin(), m_xxh64_update(), m_xxh64_end() - XXH64 of data that comes in pieces
+ *
+ * The lanes are fed 32 bytes at a time; a piece that doesn't end on a 32-byte boundary
+ * leaves the rest in x->buf for the next piece (or for m_xxh64_end()).
+*/
+void m_xxh64_begin(m_xxh64_t *x, uint64_t seed)
+{
+	x->v[0] = seed + XXH_P1 + XXH_P2;
+	x->v[1] = seed + XXH_P2;
+	x->v[2] = seed;
+	x->v[3] = seed - XXH_P1;
+	x->seed = seed;
+	x->total = 0;
+	x->nbuf = 0;
+}
+
+static inline void xxh_stripe(m_xxh64_t *x, const uint8_t *p)
+{
+	x->v[0] = xxh_round(x->v[0], xxh_get64(p));
+	x->v[1] = xxh_round(x->v[1], xxh_get64(p + 8));
+	x->v[2] = xxh_round(x->v[2], xxh_get64(p + 16));
+	x->v[3] = xxh_round(x->v[3], xxh_get64(p + 24));
+}
+
+void m_xxh64_update(m_xxh64_t *x, const uint8_t *p, unsigned long n)
+{
+	x->total += n;
+
+	if ( x->nbuf > 0 )
+	{
+		while ( n > 0 && x->nbuf < 32 )
+		{
+			x->buf[x->nbuf++] = *p++;
+			n--;
+		}
+		if ( x->nbuf < 32 )
+			return;
+		xxh_stripe(x, x->buf);
+		x->nbuf = 0;
+	}
+
+	while ( n >= 32 )
+	{
+		xxh_stripe(x, p);
+		p += 32;
+		n -= 32;
+	}
+
+	while ( n > 0 )
+	{
+		x->buf[x->nbuf++] = *p++;
+		n--;
+	}
+}
+
+uint64_t m_xxh64_end(m_xxh64_t *x)
+{
+	const uint8_t *p = x->buf;
+	const uint8_t *end = x->buf + x->nbuf;
+	uint64_t h;
+
+	if ( x->total >= 32 )
+	{
+		h = xxh_rotl(x->v[0], 1) + xxh_rotl(x->v[1], 7) + xxh_rotl(x->v[2], 12) + xxh_rotl(x->v[3], 18);
+		h = xxh_merge(h, x->v[0]);
+		h = xxh_merge(h, x->v[1]);
+		h = xxh_merge(h, x->v[2]);
+		h = xxh_merge(h, x->v[3]);
+	}
+	else
+		h = x->seed + XXH_P5;
+
+	h += x->total;
+
+	while ( (unsigned long)(end - p) >= 8 )
+	{
+		h ^= xxh_round(0, xxh_get64(p));
+		h = xxh_rotl(h, 27) * XXH_P1 + XXH_P4;
+		p += 8;
+	}
+	if ( (unsigned long)(end - p) >= 4 )
+	{
+		h ^= (uint64_t)xxh_get32(p) * XXH_P1;
+		h = xxh_rotl(h, 23) * XXH_P2 + XXH_P3;
+		p += 4;
+	}
+	while ( p < end )
+	{
+		h ^= (uint64_t)*p * XXH_P5;
+		h = xxh_rotl(h, 11) * XXH_P1;
+		p++;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_P2;
+	h ^= h >> 29;
+	h *= XXH_P3;
+	h ^= h >> 32;
+	return h;
+}
+
+uint64_t m_xxh64(const uint8_t *p, unsigned long n, uint64_t seed)
+{
+	m_xxh64_t x;
+
+	m_xxh64_begin(&x, seed);
+	m_xxh64_update(&x, p, n);
+	return m_xxh64_end(&x);
+}
+
+/* mon_xxh64_range() - XXH64 of target memory a .. a+n
+*/
+uint64_t mon_xxh64_range(memaddr_t a, memaddr_t n, uint64_t seed)
+{
+	m_xxh64_t x;
+	memaddr_t k;
+
+	m_xxh64_begin(&x, seed);
+	while ( n > 0 )
+	{
+		k = mon_memspan(a, n);
+		m_xxh64_update(&x, (const uint8_t *)mon_memptr(a), k);
+		a += k;
+		n -= k;
+	}
+	return m_xxh64_end(&x);
+}
+#endif
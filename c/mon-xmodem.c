@@ -0,0 +1,294 @@
+/*	mon-xmodem.c - monitor XMODEM/YMODEM receive
+ *
+ *	Copyright 2020 David Haworth
+ *
+ *	This file is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2, or (at your option)
+ *	any later version.
+ *
+ *	It is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; see the file COPYING.  If not, write to
+ *	the Free Software Foundation, 59 Temple Place - Suite 330,
+ *	Boston, MA 02111-1307, USA.
+ *
+ *
+ *	This file contains an XMODEM-CRC/XMODEM-1K/YMODEM receiver, so that terminal
+ *	programs like minicom and picocom (via sx/sb) can send binary files.
+ *
+ *	The receiver always asks for CRC mode ('C'). 128-byte (SOH) and 1024-byte (STX)
+ *	blocks are accepted in any mix.
+ *
+ *	YMODEM is recognised by a block 0 at the start. Only the file length is used from
+ *	the header; the data is truncated to that length. Only one file per batch is
+ *	accepted. Without YMODEM, the padding at the end of the last block is delivered too.
+ *
+ *	The data is passed in order to a streamfunc_t. If that returns < 0 the transfer
+ *	is cancelled.
+*/
+#include "monitor.h"
+#include "mon-stdio.h"
+
+#define XM_CHAR_TIMEOUT		1000000		/* 1 s within a block */
+#define XM_START_TIMEOUT	3000000		/* 3 s between blocks before sending 'C' or NAK again */
+#define XM_START_TRIES		20
+#define XM_MAXERRS			10
+
+static uint8_t block[1024 + 4];			/* blk, ~blk, data, crc */
+
+/* xm_crc16() - CRC-16/XMODEM (polynomial 0x1021, initial value 0)
+*/
+static uint16_t xm_crc16(const uint8_t *p, int n)
+{
+	uint16_t crc = 0;
+
+	while ( n > 0 )
+	{
+		crc = (uint16_t)((crc >> 8) | (crc << 8));
+		crc ^= *p++;
+		crc ^= (crc & 0xff) >> 4;
+		crc ^= (uint16_t)(crc << 12);
+		crc ^= (uint16_t)((crc & 0xff) << 5);
+		n--;
+	}
+	return crc;
+}
+
+/* xm_purge() - discard input until the line is quiet
+*/
+static void xm_purge(void)
+{
+	while ( m_readchar_timeout(XM_CHAR_TIMEOUT/4) >= 0 )
+	{
+	}
+}
+
+static void xm_cancel(void)
+{
+	xm_purge();
+	m_writechar(CAN);
+	m_writechar(CAN);
+	m_writechar(CAN);
+}
+
+/* xm_block() - read the rest of a block after the SOH/STX
+ *
+ * Returns 0 if OK, -1 if damaged or incomplete.
+*/
+static int xm_block(int size)
+{
+	int c, i;
+	int n = size + 4;
+
+	for ( i = 0; i < n; i++ )
+	{
+		c = m_readchar_timeout(XM_CHAR_TIMEOUT);
+		if ( c < 0 )
+			return -1;
+		block[i] = (uint8_t)c;
+	}
+
+	if ( (uint8_t)(block[0] + block[1]) != 0xff )
+		return -1;
+
+	if ( xm_crc16(&block[2], size) != ((block[size+2] << 8) | block[size+3]) )
+		return -1;
+
+	return 0;
+}
+
+/* xm_length() - get the file length from a YMODEM header block
+ *
+ * The block contains the file name, a NUL, then the length in decimal followed by
+ * optional fields. Returns -1 if there's no length.
+*/
+static long xm_length(const uint8_t *p, int size)
+{
+	int i = 0;
+	long len = -1;
+
+	while ( i < size && p[i] != '\0' )
+		i++;
+	i++;
+	while ( i < size && m_isdigit(p[i]) )
+	{
+		if ( len < 0 )
+			len = 0;
+		len = len * 10 + (p[i] - '0');
+		i++;
+	}
+	return len;
+}
+
+/* xmodem_receive
+ *
+ * Parameters:
+ *
+ *	out	- the function that consumes the data
+ *
+ * Return codes:
+ *	>= 0		- OK, number of bytes delivered
+ *	XM_TIMEOUT	- the sender didn't start or stopped sending
+ *	XM_CANCEL	- the sender cancelled the transfer
+ *	XM_ERROR	- too many errors, out-of-sequence block, or out() failed
+*/
+long xmodem_receive(streamfunc_t out)
+{
+	int c, size, n;
+	int errs = 0;
+	int tries = 0;
+	int ncan = 0;
+	int started = 0;
+	int ymodem = 0;
+	int header = 0;					/* Expecting a YMODEM header (block 0) */
+	int eots = 0;
+	uint8_t expect = 1;
+	long remain = -1;				/* Bytes still to come (YMODEM), or -1 for unknown */
+	long total = 0;
+	uint8_t ack = 'C';				/* What to send when nothing has arrived yet */
+
+	good_count = bad_count = 0;
+	mon_stats_begin(m_rx_count);
+
+	m_writechar(ack);
+
+	for (;;)
+	{
+		c = m_readchar_timeout(XM_START_TIMEOUT);
+
+		if ( c < 0 )
+		{
+			if ( started ? (++errs >= XM_MAXERRS) : (++tries >= XM_START_TRIES) )
+			{
+				xm_cancel();
+				return XM_TIMEOUT;
+			}
+			m_writechar(ack);
+			continue;
+		}
+
+		if ( c == CAN )
+		{
+			if ( ++ncan >= 2 )
+				return XM_CANCEL;
+			continue;
+		}
+		ncan = 0;
+
+		if ( c == EOT )
+		{
+			if ( ymodem && eots == 0 )
+			{
+				/* YMODEM: NAK the first EOT, ACK the second.
+				*/
+				eots++;
+				m_writechar(NAK);
+				continue;
+			}
+			m_writechar(ACK);
+			if ( !ymodem )
+				return total;
+
+			/* YMODEM: ask for the next header. A null header ends the batch.
+			*/
+			expect = 0;
+			header = 1;
+			eots = 0;
+			ack = 'C';
+			m_writechar(ack);
+			continue;
+		}
+
+		if ( c == SOH )
+			size = 128;
+		else
+		if ( c == STX )
+			size = 1024;
+		else
+			continue;		/* Junk: wait for the sender to time out and repeat */
+
+		if ( xm_block(size) != 0 )
+		{
+			bad_count++;
+			if ( ++errs >= XM_MAXERRS )
+			{
+				xm_cancel();
+				return XM_ERROR;
+			}
+			xm_purge();
+			m_writechar(NAK);
+			continue;
+		}
+		errs = 0;
+
+		if ( !started )
+		{
+			started = 1;
+			if ( block[0] == 0 )
+			{
+				ymodem = 1;
+				header = 1;
+				expect = 0;
+			}
+		}
+
+		if ( block[0] == (uint8_t)(expect - 1) )
+		{
+			/* Repeat of the previous block (our ACK was lost).
+			*/
+			m_writechar(ACK);
+			if ( ymodem && !header && expect == 1 && total == 0 )
+				m_writechar('C');		/* Repeated header */
+			continue;
+		}
+
+		if ( block[0] != expect )
+		{
+			xm_cancel();
+			return XM_ERROR;
+		}
+
+		if ( header )
+		{
+			/* YMODEM header block. A null file name means end of batch.
+			*/
+			m_writechar(ACK);
+			if ( block[2] == '\0' )
+				return total;
+			if ( total != 0 )
+			{
+				xm_cancel();		/* Only one file, please */
+				return XM_ERROR;
+			}
+			remain = xm_length(&block[2], size);
+			header = 0;
+			expect = 1;
+			m_writechar('C');
+			continue;
+		}
+
+		n = size;
+		if ( remain >= 0 && n > remain )
+			n = (int)remain;
+
+		if ( n > 0 && out(&block[2], n) < 0 )
+		{
+			xm_cancel();
+			return XM_ERROR;
+		}
+		good_count++;
+		mon_stats_record(n);
+		total += n;
+		if ( remain >= 0 )
+			remain -= n;
+
+		expect++;
+		ack = NAK;
+		m_writechar(ACK);
+	}
+}
@@ -22,6 +22,11 @@
  *
  *  Commands (not case sensitive):
  *		Sn....	- Type n S-Record 
+ *		P		- binary download (framed, see mon-bin.c)
+ *		Xa		- XMODEM(-1K) or YMODEM receive to address a
+ *		Xa,z	- as Xa, but the file is LZ4-compressed and is decompressed on the fly
+ *		L		- load an ELF file (received with XMODEM/YMODEM) to its physical addresses
+ *		Lg		- as L, then call the entry point
  *		Ba		- display value of byte at location a
  *		Ha		- display value of 16-bit word at location a
  *		Wa		- display value of 32-bit word at location a
@@ -31,11 +36,21 @@
  *		Wa=v	- set 32-bit word at location a to v
  *		Qa=v	- set 64-bit word at location a to v
  *		Da,l,s	- dump l words memory starting at a. Word size is s.
+ *		Ua,l	- upload l bytes of memory starting at a (framed binary, see mon-upload.c)
+ *		Ua,l,z	- as Ua,l, but the frames are LZ4-compressed where that helps
+ *		Ca,l	- print the CRC-32 of l bytes of memory starting at a
+ *		Ca,l,x	- print the XXH64 hash of l bytes of memory starting at a
+ *		Ka,l,b	- send the XXH64 hashes of each block of b bytes from a to a+l (see mon-upload.c)
+ *		Aa,l,s,c	- memory benchmark over a to a+l: bandwidth, and latency with stride s, on c cores
  *		Ma,s	- modify memory starting at a. Word size is s.  [not implemented]
  *		Zs,e	- clear (write zero to) all memory locations a, where s <= a < e
+ *		Z		- clear all memory below the monitor, as at a cold boot
  *		Ga		- call subroutine at address a on all cores
  *		Ga,c	- call subroutine at address a on core c (0 <= c <= 3)
- *		I       - print some info about no of s-records etc.
+ *		I       - print some info about no of s-records etc. and the timing of the last download
+ *		T		- turn printing of the time taken by each command on or off
+ *		Rb		- change baud rate to b (decimal), with confirmation from the host
+ *		Rb,f	- as Rb, and RTS/CTS flow control level f (0 = off, 1..4, see mon-bcm2835.c)
  *		E		- turn character echo and prompt back on
  *		?		- print help text
  *
@@ -77,23 +92,25 @@ static void dump_op(char *p);
 static void mod_op(char *p);
 static void go_op(char *p);
 static void zero_op(char *p);
+static void baud_op(char *p);
+static void bin_op(void);
+static void xmodem_op(char *p);
+static void elf_op(char *p);
+static void upload_op(char *p);
+static void check_op(char *p);
+static void hashes_op(char *p);
+static void bench_op(char *p);
 static void info(void);
 static void help(void);
 
-#ifdef poke8	/* If poke8 is a macro, we can't pass it to process_s_record */
-static void mypoke(memaddr_t a, uint8_t b)
-{
-	poke8(a, b);
-}
-#else
-#define mypoke poke8
-#endif
-
 char line[MAXLINE+2];
+int mon_timing;			/* Print the time taken by each command */
 
 void monitor(char *prompt)
 {
 	char *p;
+	unsigned long rx0;
+	uint32_t t0;
 
 	m_echo = 1;
 
@@ -103,7 +120,9 @@ void monitor(char *prompt)
 	{
 		if ( m_echo )
 			m_printf("%s", prompt);
+		rx0 = m_rx_count;
 		m_gets(line, MAXLINE);
+		t0 = mon_time_us();
 		p = m_skipspaces(line);
 		switch ( *p )
 		{
@@ -113,13 +132,17 @@ void monitor(char *prompt)
 
 		case 's':
 		case 'S':
-			switch ( process_s_record(p, mypoke) )
+			if ( m_echo )
+				mon_stats_begin(rx0);	/* First record of a download */
+			switch ( process_s_record(p, mon_write) )
 			{
 			case 0:		/* OK - no message */
 				m_echo = 0;
+				mon_console_pipeline_start();
 				break;
 
 			case SREC_EOF:
+				mon_console_pipeline_stop();
 				m_echo = 1;
 				m_printf("End of S-record file\n");
 				break;
@@ -131,9 +154,28 @@ void monitor(char *prompt)
 				m_printf("Bad S-record: \"%s\"\n", line);
 				break;
 
+			case SREC_BADADDR:
+				m_printf("S-record would overwrite the monitor: \"%s\"\n", line);
+				break;
+
 			}
 			break;
 
+		case 'p':		/* Rest of line ignored */
+		case 'P':
+			bin_op();
+			break;
+
+		case 'x':
+		case 'X':
+			xmodem_op(p+1);
+			break;
+
+		case 'l':
+		case 'L':
+			elf_op(p+1);
+			break;
+
 		case 'b':
 		case 'B':
 			word_op(1, p+1);
@@ -164,6 +206,26 @@ void monitor(char *prompt)
 			mod_op(p+1);
 			break;
 
+		case 'u':
+		case 'U':
+			upload_op(p+1);
+			break;
+
+		case 'c':
+		case 'C':
+			check_op(p+1);
+			break;
+
+		case 'k':
+		case 'K':
+			hashes_op(p+1);
+			break;
+
+		case 'a':
+		case 'A':
+			bench_op(p+1);
+			break;
+
 		case 'g':
 		case 'G':
 			go_op(p+1);
@@ -174,8 +236,14 @@ void monitor(char *prompt)
 			zero_op(p+1);
 			break;
 
+		case 'r':
+		case 'R':
+			baud_op(p+1);
+			break;
+
 		case 'e':		/* Rest of line ignored */
 		case 'E':
+			mon_console_pipeline_stop();
 			m_echo = 1;
 			break;
 
@@ -184,6 +252,12 @@ void monitor(char *prompt)
 			info();
 			break;
 
+		case 't':		/* Rest of line ignored */
+		case 'T':
+			mon_timing = !mon_timing;
+			m_printf("Command timing %s\n", mon_timing ? "on" : "off");
+			break;
+
 		case '?':		/* Rest of line ignored */
 			help();
 			break;
@@ -192,19 +266,29 @@ void monitor(char *prompt)
 			m_printf("%s\n", what);
 			break;
 		}
+
+		/* Not while a download is running: the host isn't expecting it.
+		*/
+		if ( mon_timing && m_echo && *p != '\0' )
+			m_printf("Time: %lu us\n", (unsigned long)(mon_time_us() - t0));
 	}
 }
 
 static void info(void)
 {
 	m_printf("Download information\n");
-	m_printf("    No. of good S-records : %d\n", good_count);
-	m_printf("    No. of bad S-records  : %d\n", bad_count);
+	m_printf("    No. of good S-records/frames : %d\n", good_count);
+	m_printf("    No. of bad S-records/frames  : %d\n", bad_count);
+	mon_stats_info();
 }
 
 static void help(void)
 {
 	m_printf("    Sn....  - Type n S-Record\n");
+	m_printf("    P       - binary download (framed)\n");
+	m_printf("    Xa      - XMODEM or YMODEM receive to address a\n");
+	m_printf("    Xa,z    - XMODEM or YMODEM receive of an LZ4 file, decompressed to a\n");
+	m_printf("    L[g]    - XMODEM or YMODEM receive of an ELF file, loaded [and called]\n");
 	m_printf("    Ba      - display value of byte at location a\n");
 	m_printf("    Ha      - display value of 16-bit word at location a\n");
 	m_printf("    Wa      - display value of 32-bit word at location a\n");
@@ -214,13 +298,20 @@ static void help(void)
 	m_printf("    Wa=v    - set 32-bit word at location a to v\n");
 	m_printf("    Qa=v    - set 64-bit word at location a to v\n");
 	m_printf("    Da,l,s  - dump l words memory starting at a. Word size is s.\n");
+	m_printf("    Ua,l[,z]- upload l bytes of memory starting at a [LZ4-compressed]\n");
+	m_printf("    Ca,l[,x]- CRC-32 [XXH64] of l bytes of memory starting at a\n");
+	m_printf("    Ka,l[,b]- send XXH64 hashes of blocks of b bytes (default 1000) from a to a+l\n");
+	m_printf("    Aa,l[,s[,c]] - memory benchmark from a to a+l, stride s (default 40), c cores\n");
 #if 0
 	m_printf("    Ma,s    - modify memory starting at a. Word size is s.\n");
 #endif
 	m_printf("    Ga      - call subroutine at address a on all cores\n");
 	m_printf("    Ga,c    - call subroutine at address a on core c\n");
 	m_printf("    Zs,e    - zero memory all memory locations a, where s <= a < e\n");
-	m_printf("    I       - print some info about no of s-records etc.\n");
+	m_printf("    Z       - zero all memory below the monitor (as at cold boot)\n");
+	m_printf("    I       - print some info about no of s-records etc. and download timing\n");
+	m_printf("    T       - turn printing of the time taken by each command on/off\n");
+	m_printf("    Rb[,f]  - change baud rate to b (decimal) [and RTS/CTS flow control f, 0-4]. Host confirms with ENQ\n");
 	m_printf("    E       - re-enable echo (after an incomplete S-record transfer)\n");
 	m_printf("    ?       - show this help text\n");
 }
@@ -298,11 +389,11 @@ static void word_op(int s, char *p)
 
 void dump_op(char *p)
 {
-	memaddr_t a, ca;
+	memaddr_t a;
 	int l = 16;
 	int s = 1;
-	int i;
-	int c;
+	int i, n;
+	uint8_t b[16];
 
 	p = m_skipspaces(p);
 	a = gethex(&p, sizeof(memaddr_t)*2);
@@ -361,7 +452,7 @@ void dump_op(char *p)
 	{
 		m_printf("%08x", a);
 		i = 16;
-		ca = a;
+		n = 0;
 		while ( i > 0 && l > 0 )
 		{
 			if ( s == 1 && i == 8 )
@@ -369,7 +460,9 @@ void dump_op(char *p)
 			switch ( s )
 			{
 			case 1:
-				m_printf(" %02x", peek8(a));
+				b[n] = peek8(a);		/* Read once; the ASCII column uses the copy */
+				m_printf(" %02x", b[n]);
+				n++;
 				break;
 			case 2:
 				m_printf(" %04x", peek16(a));
@@ -388,13 +481,8 @@ void dump_op(char *p)
 		if ( s == 1 )
 		{
 			m_printf("   ");
-			while ( ca < a )
-			{
-				c = peek8(ca++);
-				if ( c <= 0x20 || c >= 0x7f )
-					c = '.';
-				m_printf("%c", c);
-			}
+			for ( i = 0; i < n; i++ )
+				m_printf("%c", (b[i] <= 0x20 || b[i] >= 0x7f) ? '.' : b[i]);
 		}
 		m_printf("\n");
 	}
@@ -440,25 +528,39 @@ void go_op(char *p)
 			return;
 		}
 
+		mon_sync_code();
 		if ( c ==  0 )
+		{
+			mon_console_release();
 			go(a);
+			mon_console_reclaim();
+		}
 		else
 			release(c, a);
 	}
 	else
 	{
+		mon_sync_code();
 		release(1, a);
 		release(2, a);
 		release(3, a);
+		mon_console_release();
 		go(a);
+		mon_console_reclaim();
 	}
 }
 
 void zero_op(char *p)
 {
-	memaddr_t s, e=0, l;
+	memaddr_t s, e=0;
 
 	p = m_skipspaces(p);
+	if ( *p == '\0' )
+	{
+		mon_clear_low();
+		return;
+	}
+
 	s = gethex(&p, sizeof(memaddr_t)*2);
 
 	if ( p == NULL )
@@ -497,28 +599,574 @@ void zero_op(char *p)
 		return;
 	}
 
-	l = e & ~0x7; /* The limit for 64-bit words */
+	mon_parallel(mon_zero, s, e - s);
+}
+
+/* bin_op() - binary download
+ *
+ * The host waits for the "ready" line before sending the first frame.
+*/
+void bin_op(void)
+{
+	int r;
+
+	mon_console_pipeline_start();
+	m_printf("Binary download ready\n");
+	m_flush();
+
+	r = bin_download(mon_write);
+	mon_console_pipeline_stop();
+
+	switch ( r )
+	{
+	case BIN_EOF:
+		m_printf("\nEnd of binary download\n");
+		break;
+
+	case BIN_TIMEOUT:
+		m_printf("\nBinary download timed out\n");
+		break;
+
+	case BIN_CANCEL:
+		m_printf("\nBinary download cancelled\n");
+		break;
+
+	case BIN_BADADDR:
+		m_printf("\nBinary download would overwrite the monitor\n");
+		break;
+	}
+}
+
+/* check_op() - CRC-32 or XXH64 of a memory range, for checking a download
+*/
+void check_op(char *p)
+{
+	memaddr_t a, n;
+	uint32_t t0, t;
+	int x = 0;
+
+	p = m_skipspaces(p);
+	a = gethex(&p, sizeof(memaddr_t)*2);
+	if ( p == NULL )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
+
+	p = m_skipspaces(p);
+	if ( *p != ',' )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
+	p = m_skipspaces(p+1);
+	n = gethex(&p, sizeof(memaddr_t)*2);
+	if ( p == NULL )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
+
+	p = m_skipspaces(p);
+	if ( *p == ',' )
+	{
+		p = m_skipspaces(p+1);
+		if ( *p != 'x' && *p != 'X' )
+		{
+			m_printf("%s\n", how);
+			return;
+		}
+		x = 1;
+		p = m_skipspaces(p+1);
+	}
+
+	if ( *p != '\0' )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
+
+	t0 = mon_time_us();
+	if ( x )
+	{
+#if MON_64BIT
+		uint64_t h = mon_xxh64_range(a, n, 0);
+		t = mon_time_us() - t0;
+		m_printf("XXH64 %08lx to %08lx: %016lx (%u us)\n", a, a+n, h, t);
+#else
+		m_printf("%s\n", sorry);
+#endif
+	}
+	else
+	{
+		uint32_t crc = mon_crc32_range(a, n);
+		t = mon_time_us() - t0;
+		m_printf("CRC-32 %08lx to %08lx: %08x (%u us)\n", a, a+n, crc, t);
+	}
+}
+
+/* bench_op() - memory bandwidth and latency benchmark (overwrites the range)
+*/
+void bench_op(char *p)
+{
+	memaddr_t a, l, s = 64;
+	int c = 1;
+
+	p = m_skipspaces(p);
+	a = gethex(&p, sizeof(memaddr_t)*2);
+	if ( p == NULL )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
+
+	p = m_skipspaces(p);
+	if ( *p != ',' )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
+	p = m_skipspaces(p+1);
+	l = gethex(&p, sizeof(memaddr_t)*2);
+	if ( p == NULL )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
 
-	if ( s < l )
+	p = m_skipspaces(p);
+	if ( *p == ',' )
 	{
-		while ( (s & 0x07) != 0 )
+		p = m_skipspaces(p+1);
+		s = gethex(&p, sizeof(memaddr_t)*2);
+		if ( p == NULL )
 		{
-			poke8(s, 0);
-			s++;
+			m_printf("%s\n", how);
+			return;
 		}
+		p = m_skipspaces(p);
+		if ( *p == ',' )
+		{
+			p = m_skipspaces(p+1);
+			c = gethex(&p, 1);
+			if ( p == NULL )
+			{
+				m_printf("%s\n", how);
+				return;
+			}
+			p = m_skipspaces(p);
+		}
+	}
 
-		/* s is now aligned to 64-bit word */
+	if ( *p != '\0' )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
+
+	if ( c < 1 || c > 4 )
+	{
+		m_printf("%s\n", sorry);
+		return;
+	}
+
+	mon_bench(a, l, s, c);
+}
+
+/* hashes_op() - send the block hashes of a memory range, so that the host can send
+ * only the blocks that have changed
+*/
+#define MON_HASH_BLOCK	0x1000
+
+void hashes_op(char *p)
+{
+	memaddr_t a, n, bs = MON_HASH_BLOCK;
+	long r;
+
+	p = m_skipspaces(p);
+	a = gethex(&p, sizeof(memaddr_t)*2);
+	if ( p == NULL )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
 
-		while ( s < l )
+	p = m_skipspaces(p);
+	if ( *p != ',' )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
+	p = m_skipspaces(p+1);
+	n = gethex(&p, sizeof(memaddr_t)*2);
+	if ( p == NULL )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
+
+	p = m_skipspaces(p);
+	if ( *p == ',' )
+	{
+		p = m_skipspaces(p+1);
+		bs = gethex(&p, sizeof(memaddr_t)*2);
+		if ( p == NULL )
 		{
-			poke64(s, 0);
-			s += 8;
+			m_printf("%s\n", how);
+			return;
 		}
+		p = m_skipspaces(p);
 	}
 
-	while ( s < e )
+	if ( *p != '\0' )
 	{
-		poke8(s, 0);
-		s++;
+		m_printf("%s\n", how);
+		return;
 	}
+
+#if MON_64BIT
+	if ( bs == 0 )
+	{
+		m_printf("%s\n", sorry);
+		return;
+	}
+
+	m_printf("Block hashes ready: send ACK to start\n");
+	m_flush();
+
+	r = bin_hashes(a, n, bs);
+
+	switch ( r )
+	{
+	case UP_TIMEOUT:
+		m_printf("\nBlock hashes timed out\n");
+		break;
+
+	case UP_CANCEL:
+		m_printf("\nBlock hashes cancelled\n");
+		break;
+
+	default:
+		m_printf("\nHashed %08lx to %08lx in blocks of %lx\n", a, a+n, bs);
+		break;
+	}
+#else
+	(void)r;
+	m_printf("%s\n", sorry);
+#endif
+}
+
+/* upload_op() - binary upload of a memory range
+*/
+void upload_op(char *p)
+{
+	memaddr_t a, n;
+	long r;
+	int z = 0;
+
+	p = m_skipspaces(p);
+	a = gethex(&p, sizeof(memaddr_t)*2);
+	if ( p == NULL )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
+
+	p = m_skipspaces(p);
+	if ( *p != ',' )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
+	p = m_skipspaces(p+1);
+	n = gethex(&p, sizeof(memaddr_t)*2);
+	if ( p == NULL )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
+
+	p = m_skipspaces(p);
+	if ( *p == ',' )
+	{
+		p = m_skipspaces(p+1);
+		if ( *p != 'z' && *p != 'Z' )
+		{
+			m_printf("%s\n", how);
+			return;
+		}
+		z = 1;
+		p = m_skipspaces(p+1);
+	}
+
+	if ( *p != '\0' )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
+
+	m_printf("Binary upload ready: send ACK to start\n");
+	m_flush();
+
+	r = bin_upload(a, n, z);
+
+	switch ( r )
+	{
+	case UP_TIMEOUT:
+		m_printf("\nBinary upload timed out\n");
+		break;
+
+	case UP_CANCEL:
+		m_printf("\nBinary upload cancelled\n");
+		break;
+
+	default:
+		m_printf("\nUploaded %08lx to %08lx in %ld bytes\n", a, a+n, r);
+		break;
+	}
+}
+
+/* xmodem_op() - XMODEM/YMODEM receive to memory
+*/
+static memaddr_t stream_addr;
+
+static int raw_stream(const uint8_t *b, int n)
+{
+	if ( mon_write(stream_addr, b, n) != 0 )
+		return -1;
+	stream_addr += n;
+	return 0;
+}
+
+void xmodem_op(char *p)
+{
+	memaddr_t a;
+	long n;
+	int z = 0;
+
+	p = m_skipspaces(p);
+	a = gethex(&p, sizeof(memaddr_t)*2);
+	if ( p == NULL )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
+
+	p = m_skipspaces(p);
+	if ( *p == ',' )
+	{
+		p = m_skipspaces(p+1);
+		if ( *p != 'z' && *p != 'Z' )
+		{
+			m_printf("%s\n", how);
+			return;
+		}
+		z = 1;
+		p = m_skipspaces(p+1);
+	}
+
+	if ( *p != '\0' )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
+
+	mon_console_pipeline_start();
+	m_printf("Ready for XMODEM/YMODEM%s to %08lx\n", z ? " (LZ4)" : "", a);
+	m_flush();
+
+	if ( z )
+	{
+		lz4_init(a, mon_write);
+		n = xmodem_receive(lz4_stream);
+	}
+	else
+	{
+		stream_addr = a;
+		n = xmodem_receive(raw_stream);
+	}
+	mon_console_pipeline_stop();
+
+	/* Give the sender time to finish before printing.
+	*/
+	m_delay_us(500000);
+	switch ( n )
+	{
+	case XM_TIMEOUT:
+		m_printf("\nTransfer timed out\n");
+		break;
+
+	case XM_CANCEL:
+		m_printf("\nTransfer cancelled\n");
+		break;
+
+	case XM_ERROR:
+		m_printf("\nTransfer failed\n");
+		break;
+
+	default:
+		m_printf("\nReceived %ld bytes", n);
+		if ( z )
+		{
+			n = lz4_finish();
+			if ( n < 0 )
+			{
+				m_printf(", LZ4 data incomplete\n");
+				break;
+			}
+			m_printf(", decompressed to %ld", n);
+		}
+		m_printf(" (%08lx to %08lx)\n", a, a+n);
+		break;
+	}
+}
+
+/* elf_op() - load an ELF file, received with XMODEM/YMODEM
+ *
+ * Only the loadable segments are transferred to memory; the bss is cleared here.
+*/
+void elf_op(char *p)
+{
+	long n, e;
+	memaddr_t entry;
+	int g = 0;
+
+	p = m_skipspaces(p);
+	if ( *p == 'g' || *p == 'G' )
+	{
+		g = 1;
+		p = m_skipspaces(p+1);
+	}
+
+	if ( *p != '\0' )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
+
+	mon_console_pipeline_start();
+	m_printf("Ready for ELF file via XMODEM/YMODEM\n");
+	m_flush();
+
+	elf_init(mon_write);
+	n = xmodem_receive(elf_stream);
+	e = elf_finish(&entry);
+	mon_console_pipeline_stop();
+
+	/* Give the sender time to finish before printing.
+	*/
+	m_delay_us(500000);
+
+	if ( n == XM_TIMEOUT )
+		m_printf("\nTransfer timed out\n");
+	else
+	if ( n == XM_CANCEL )
+		m_printf("\nTransfer cancelled\n");
+	else
+	switch ( e )
+	{
+	case ELF_BADHDR:
+		m_printf("\nNot an ELF executable for this machine\n");
+		break;
+
+	case ELF_BADPH:
+		m_printf("\nUnsupported ELF program headers\n");
+		break;
+
+	case ELF_BADADDR:
+		m_printf("\nELF segment would overwrite the monitor\n");
+		break;
+
+	case ELF_INCOMPLETE:
+		m_printf("\nTransfer failed\n");
+		break;
+
+	default:
+		m_printf("\nLoaded %ld bytes, entry point %08lx\n", e, entry);
+		if ( g )
+		{
+			mon_sync_code();
+			m_flush();
+			mon_console_release();
+			go(entry);
+			mon_console_reclaim();
+		}
+		break;
+	}
+}
+
+/* baud_op() - change the baud rate, with confirmation from the host
+ *
+ *	1. The monitor replies "Baud b: send ENQ at the new rate" at the old rate.
+ *	2. When the reply has been sent, the monitor waits MON_BAUD_TURNAROUND and then switches.
+ *	3. The host switches and sends ENQ. The monitor answers ACK and a message at the new rate.
+ *	4. If there's no ENQ within MON_BAUD_CONFIRM, the monitor falls back to MON_DEFAULT_BAUD.
+ *
+ * Anything else that arrives while waiting (e.g. junk caused by the switch) is ignored.
+*/
+#define MON_BAUD_TURNAROUND		100000		/* 100 ms */
+#define MON_BAUD_CONFIRM		5000000		/* 5 s */
+
+void baud_op(char *p)
+{
+	uint32_t b, t0, t;
+	int c;
+	int f = 0;
+
+	p = m_skipspaces(p);
+	b = getdec(&p, 8);
+	if ( p == NULL )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
+
+	p = m_skipspaces(p);
+	if ( *p == ',' )
+	{
+		p = m_skipspaces(p+1);
+		f = (int)getdec(&p, 1);
+		if ( p == NULL )
+		{
+			m_printf("%s\n", how);
+			return;
+		}
+		p = m_skipspaces(p);
+	}
+
+	if ( *p != '\0' )
+	{
+		m_printf("%s\n", how);
+		return;
+	}
+
+	if ( !mon_console_baudok(b) || !mon_console_flowok(f) )
+	{
+		m_printf("%s\n", sorry);
+		return;
+	}
+
+	m_printf("Baud %u: send ENQ at the new rate\n", b);
+	m_flush();
+	m_delay_us(MON_BAUD_TURNAROUND);
+	mon_console_setflow(f);
+	mon_console_setbaud(b);
+
+	t0 = mon_time_us();
+	do {
+		t = mon_time_us() - t0;
+		if ( t >= MON_BAUD_CONFIRM )
+			break;
+		c = m_readchar_timeout(MON_BAUD_CONFIRM - t);
+		if ( c == ENQ )
+		{
+			m_writechar(ACK);
+			m_printf("\nBaud rate is %u, flow control %d\n", b, f);
+			return;
+		}
+	} while ( c >= 0 );
+
+	mon_console_setflow(0);
+	mon_console_setbaud(MON_DEFAULT_BAUD);
+	m_printf("No confirmation. Baud rate is %u, no flow control\n", MON_DEFAULT_BAUD);
 }
@@ -0,0 +1,53 @@
+/*  mon-arm64-mmu.h - ARM64 MMU and cache control for monitor and loader
+ *
+ *  Copyright 2020 David Haworth
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef mon_arm64_mmu_h
+#define mon_arm64_mmu_h	1
+
+#include "monitor.h"
+
+/* The MMU maps everything 1:1 (virtual address == physical address).
+ *
+ *	0x00000000 .. BCM2835_PBASE-1	normal memory, write-back cacheable, inner shareable
+ *	BCM2835_PBASE .. 0x3fffffff		peripherals, device-nGnRE
+ *	0x40000000 .. 0x7fffffff		local peripherals (ARM control etc.), device-nGnRE
+ *
+ * Nothing above 2 GiB is mapped.
+ *
+ * mon_mmu_on() turns on the MMU, the data cache and the instruction cache on the calling core.
+ * mon_mmu_on_secondary() does the same on another core, once the first core has built the tables.
+ * mon_mmu_off() writes the data cache back to memory and turns them all off again.
+ *
+ * All the cores that share memory must have their caches on (or all off), and the cores
+ * must be in SMP mode (CPUECTLR_EL1.SMPEN, see mon-arm64-reset.S), otherwise the data
+ * caches aren't coherent.
+*/
+extern void mon_mmu_on(void);
+extern void mon_mmu_on_secondary(void);
+extern void mon_mmu_off(void);
+
+/* In mon-arm64-cache.S
+*/
+extern void mon_mmu_enable(uint64_t *ttbr, uint64_t tcr, uint64_t mair);
+extern void mon_mmu_disable(void);
+extern void mon_dcache_clean_all(void);
+
+/* In mon-arm64-copy.S
+*/
+extern void mon_copy(memaddr_t d, memaddr_t s, memaddr_t n);
+
+#endif
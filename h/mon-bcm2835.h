@@ -19,6 +19,7 @@
 #define mon_bcm2835_h	1
 
 #include "monitor.h"
+#include "mon-ring.h"
 
 #ifndef BCM2835_PBASE
 #error	"No definition of BCM2835_PBASE in the board headers. Please fix!"
@@ -54,6 +55,116 @@ static inline void bcm2835_disable(uint32_t per)
 #define BCM2835_AUX_spi1	0x02
 #define BCM2835_AUX_spi2	0x04
 
+/* BCM2835 interrupt controller (the "ARM" interrupt controller in the BCM2835 doc)
+ *
+ * The GPU peripherals' interrupts 0..63 appear in pending[], enable[] and disable[].
+ * On the Pi 3 these are routed to core 0 by default.
+*/
+typedef struct bcm2835_intc_s bcm2835_intc_t;
+
+struct bcm2835_intc_s
+{
+	reg32_t pending_basic;	/* 0x200	basic pending */
+	reg32_t pending[2];		/* 0x204	pending 0..31, 32..63 */
+	reg32_t fiq_ctl;		/* 0x20c	FIQ control */
+	reg32_t enable[2];		/* 0x210	write 1 to enable */
+	reg32_t enable_basic;	/* 0x218	write 1 to enable */
+	reg32_t disable[2];		/* 0x21c	write 1 to disable */
+	reg32_t disable_basic;	/* 0x224	write 1 to disable */
+};
+
+#define bcm2835_intc	((bcm2835_intc_t *)(BCM2835_PBASE+0xb200))[0]
+
+#define BCM2835_IRQ_AUX		29		/* Mini-uart and both aux SPIs */
+#define BCM2835_IRQ_UART	57		/* PL011 uart */
+
+static inline void bcm2835_irq_enable(uint32_t irq)
+{
+	bcm2835_intc.enable[irq/32] = 1 << (irq%32);
+}
+
+static inline void bcm2835_irq_disable(uint32_t irq)
+{
+	bcm2835_intc.disable[irq/32] = 1 << (irq%32);
+}
+
+/* BCM2835 system timer
+ *
+ * A free-running 64-bit counter at 1 MHz, with four compare registers.
+ * The low 32 bits are enough for measuring intervals of up to an hour or so.
+*/
+typedef struct bcm2835_timer_s bcm2835_timer_t;
+
+struct bcm2835_timer_s
+{
+	reg32_t cs;			/* 0x00	control/status */
+	reg32_t clo;		/* 0x04	counter, low 32 bits */
+	reg32_t chi;		/* 0x08	counter, high 32 bits */
+	reg32_t cmp[4];		/* 0x0c	compare registers */
+};
+
+#define bcm2835_timer	((bcm2835_timer_t *)(BCM2835_PBASE+0x3000))[0]
+
+static inline uint32_t bcm2835_time_us(void)
+{
+	return bcm2835_timer.clo;
+}
+
+/* Processor interrupt mask
+*/
+static inline void bcm2835_cpu_irq_unmask(void)
+{
+#if MON_64BIT
+	__asm__ volatile ("msr daifclr, #2" : : : "memory");
+#else
+	__asm__ volatile ("cpsie i" : : : "memory");
+#endif
+}
+
+static inline void bcm2835_cpu_irq_mask(void)
+{
+#if MON_64BIT
+	__asm__ volatile ("msr daifset, #2" : : : "memory");
+#else
+	__asm__ volatile ("cpsid i" : : : "memory");
+#endif
+}
+
+/* Processor events
+ *
+ * An idle core waits in WFE instead of spinning on memory. Whoever changes what it's waiting
+ * for calls bcm2835_cpu_sev() afterwards; the dsb makes sure the change is visible before
+ * the event. An event that comes between the core's check and its WFE isn't lost: it makes
+ * the WFE return at once.
+*/
+static inline void bcm2835_cpu_wfe(void)
+{
+#if MON_64BIT
+	__asm__ volatile ("wfe" : : : "memory");
+#endif
+}
+
+static inline void bcm2835_cpu_sev(void)
+{
+#if MON_64BIT
+	__asm__ volatile ("dsb ish; sev" : : : "memory");
+#endif
+}
+
+/* bcm2835_cpu_event_stream() - wake this core from WFE every 2^(n+1) ticks of the generic
+ * timer, in case something is changed without an SEV (CNTKCTL_EL1: EVNTI = n, EVNTEN)
+*/
+static inline void bcm2835_cpu_event_stream(int n)
+{
+#if MON_64BIT
+	uint64_t k;
+
+	__asm__ volatile ("mrs %0, cntkctl_el1" : "=r"(k));
+	k = (k & ~(uint64_t)0xfc) | ((uint64_t)n << 4) | 0x04;
+	__asm__ volatile ("msr cntkctl_el1, %0" : : "r"(k));
+#endif
+}
+
 /* BCM2835 GPIO
  *
  * There are 54 GPIO channels, most of which have at least one more function
@@ -193,9 +304,23 @@ struct bcm2835_uart_s
 #define bcm2835_uart	((bcm2835_uart_t *)(BCM2835_PBASE+0x215040))[0]
 
 extern void bcm2835_uart_init(uint32_t baud, uint32_t bits, uint32_t parity);
+extern int bcm2835_uart_setbaud(uint32_t baud);
+extern int bcm2835_uart_baudok(uint32_t baud);
+extern int bcm2835_uart_setflow(int level);
+extern int bcm2835_uart_flow;
+
+/* The mini uart's baud rate is derived from the VPU core clock:
+ *	baud = core_clock / (8 * (divisor + 1))
+ * 250 MHz is the default core clock on the Pi 3. If config.txt changes core_freq,
+ * define BCM2835_CORE_CLK to match.
+*/
+#ifndef BCM2835_CORE_CLK
+#define BCM2835_CORE_CLK	250000000
+#endif
 
 #define BCM2835_IER_TxInt		0x02
 #define BCM2835_IER_RxInt		0x01
+#define BCM2835_IER_Required	0x0c	/* Documented as don't care, but needed for interrupts (errata) */
 
 #define BCM2835_IIR_Iid			0x06	/* Apparently both bits set isn't possible */
 #define BCM2835_IIR_Iid_Rx		0x04
@@ -216,7 +341,15 @@ extern void bcm2835_uart_init(uint32_t baud, uint32_t bits, uint32_t parity);
 
 #define BCM2835_MSR_CTS			0x20	/* 1 = CTS low */
 
-										/* cntl has various hardware flow control bits in 7..2, not defined here */
+#define BCM2835_CNTL_CtsLow		0x80	/* 1 = CTS asserted when low */
+#define BCM2835_CNTL_RtsLow		0x40	/* 1 = RTS asserted when low */
+#define BCM2835_CNTL_RtsLevel	0x30	/* De-assert RTS when the rx fifo has only ... places left: */
+#define BCM2835_CNTL_Rts3		0x00	/*	3 */
+#define BCM2835_CNTL_Rts2		0x10	/*	2 */
+#define BCM2835_CNTL_Rts1		0x20	/*	1 */
+#define BCM2835_CNTL_Rts4		0x30	/*	4 */
+#define BCM2835_CNTL_CtsFlow	0x08	/* 1 = transmitter stops while CTS is de-asserted */
+#define BCM2835_CNTL_RtsFlow	0x04	/* 1 = RTS is de-asserted when the rx fifo is nearly full */
 #define BCM2835_CNTL_TxEn		0x02	/* 1 = receiver enabled */
 #define BCM2835_CNTL_RxEn		0x01	/* 1 = transmitter enabled */
 
@@ -233,6 +366,87 @@ extern void bcm2835_uart_init(uint32_t baud, uint32_t bits, uint32_t parity);
 #define BCM2835_STAT_TxSpace	0x00000002
 #define BCM2835_STAT_RxChar		0x00000001		/* Receiver fifo contains 1 or more characters */
 
+/* Hardware flow control: CTS is on gpio16 and RTS on gpio17 (alt5). Both are active low,
+ * as on the usual USB serial adapters. If yours disagrees, define BCM2835_UART_FLOW_POL
+ * to 0 (active high).
+*/
+#ifndef BCM2835_UART_FLOW_POL
+#define BCM2835_UART_FLOW_POL	(BCM2835_CNTL_CtsLow | BCM2835_CNTL_RtsLow)
+#endif
+
+/* Interrupt-driven receive and transmit.
+ *
+ * When MON_UART_IRQ is enabled, bcm2835_uart_irq_start() turns on the receive interrupt.
+ * The interrupt handler moves characters from the 8-deep hardware fifo into a much larger
+ * ring buffer, and bcm2835_uart_getc() reads from there.
+ *
+ * In the other direction, bcm2835_uart_putc() only copies the character into the transmit
+ * ring and enables the transmit interrupt; the handler feeds the fifo and disables the
+ * interrupt again when the ring is empty. bcm2835_uart_flush() waits until everything
+ * has gone.
+ *
+ * The rings have a single producer and consumer, so only core 0 uses them. Output from
+ * other cores is written directly to the fifo.
+ *
+ * The exception is the receive pipeline used for downloads: bcm2835_uart_pump() runs on
+ * another core and polls the receive fifo into the receive ring. While it runs, the
+ * interrupt handler leaves the receive side alone (bcm2835_uart_ier_rx is 0), so the ring
+ * still has only one producer.
+ *
+ * Lost characters are counted in bcm2835_uart_overruns: a fifo overrun (BCM2835_LSR_RxOver)
+ * counts one, however many characters went, and so does each character dropped because the
+ * ring was full.
+ *
+ * With flow control on (bcm2835_uart_setflow()) nothing is dropped: when the ring is full
+ * the characters stay in the fifo, so the uart de-asserts RTS and the host waits. The
+ * interrupt handler turns the receive interrupt off (bcm2835_uart_throttled) and
+ * bcm2835_uart_unthrottle() turns it on again when bcm2835_uart_getc() has emptied half
+ * the ring.
+*/
+#ifndef MON_UART_IRQ
+#define MON_UART_IRQ	0
+#endif
+
+/* The rings and the interrupt handling are only needed when the mini uart is the console.
+*/
+#if MON_UART_IRQ && MON_CONSOLE == MON_MINIUART
+#define BCM2835_UART_IRQ	1
+#else
+#define BCM2835_UART_IRQ	0
+#endif
+
+#define BCM2835_RXBUF_SIZE	4096	/* Must be a power of 2 */
+#define BCM2835_TXBUF_SIZE	4096	/* Must be a power of 2 */
+
+extern mon_ring_t bcm2835_rxring;
+extern mon_ring_t bcm2835_txring;
+extern int bcm2835_uart_irqmode;
+extern uint32_t bcm2835_uart_ier_rx;
+extern uint32_t bcm2835_uart_overruns;
+extern int bcm2835_uart_throttled;
+extern int bcm2835_uart_pumping;
+extern int bcm2835_uart_pump_alive;
+
+extern void bcm2835_uart_irq_start(void);
+extern void bcm2835_uart_irq_stop(void);
+extern void bcm2835_uart_irq(void);
+extern void bcm2835_uart_flush(void);
+extern void bcm2835_uart_pump_begin(void);
+extern void bcm2835_uart_pump_end(void);
+extern int bcm2835_uart_pump(int c);
+extern void bcm2835_uart_unthrottle(void);
+
+static inline int bcm2835_core_id(void)
+{
+#if MON_64BIT
+	uint64_t mpidr;
+	__asm__ volatile ("mrs %0, mpidr_el1" : "=r"(mpidr));
+	return (int)(mpidr & 0xff);
+#else
+	return 0;
+#endif
+}
+
 static inline int bcm2835_uart_istx(void)
 {
 	return ( (bcm2835_uart.stat & BCM2835_STAT_TxSpace) != 0 );
@@ -243,8 +457,29 @@ static inline int bcm2835_uart_isrx(void)
 	return ( (bcm2835_uart.stat & BCM2835_STAT_RxNchars) != 0 );
 }
 
+static inline int bcm2835_uart_rxready(void)
+{
+#if BCM2835_UART_IRQ
+	if ( bcm2835_uart_irqmode )
+		return ( mon_ring_count(&bcm2835_rxring) != 0 );
+#endif
+	return bcm2835_uart_isrx();
+}
+
 static inline int bcm2835_uart_putc(int c)
 {
+#if BCM2835_UART_IRQ
+	if ( bcm2835_uart_irqmode && bcm2835_core_id() == 0 )
+	{
+		while ( mon_ring_space(&bcm2835_txring) == 0 )
+		{
+			/* Wait till the interrupt handler makes room */
+		}
+		mon_ring_put(&bcm2835_txring, (uint8_t)c);
+		bcm2835_uart.ier = BCM2835_IER_Required | bcm2835_uart_ier_rx | BCM2835_IER_TxInt;
+		return 1;
+	}
+#endif
 	while ( !bcm2835_uart_istx() )
 	{
 		/* Wait till there's room */
@@ -255,10 +490,27 @@ static inline int bcm2835_uart_putc(int c)
 
 static inline int bcm2835_uart_getc(void)
 {
+#if BCM2835_UART_IRQ
+	if ( bcm2835_uart_irqmode )
+	{
+		int c;
+
+		while ( mon_ring_count(&bcm2835_rxring) == 0 )
+		{
+			/* Wait till the interrupt handler delivers a character */
+		}
+		c = (int)mon_ring_get(&bcm2835_rxring);
+		if ( bcm2835_uart_throttled )
+			bcm2835_uart_unthrottle();
+		return c;
+	}
+#endif
 	while ( !bcm2835_uart_isrx() )
 	{
 		/* Wait till there's a character */
 	}
+	if ( (bcm2835_uart.lsr & BCM2835_LSR_RxOver) != 0 )
+		bcm2835_uart_overruns++;
 	return (int)bcm2835_uart.io;
 }
 
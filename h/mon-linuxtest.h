@@ -0,0 +1,43 @@
+/*	mon-linuxtest.h - linux host test board for monitor
+ *
+ *	Copyright 2020 David Haworth
+ *
+ *	This file is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2, or (at your option)
+ *	any later version.
+ *
+ *	It is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; see the file COPYING.  If not, write to
+ *	the Free Software Foundation, 59 Temple Place - Suite 330,
+ *	Boston, MA 02111-1307, USA.
+ *
+ *
+ *	This file contains the "hardware" interface of the linux test board.
+ *	The console is a file descriptor pair (stdin/stdout or a pseudo-terminal)
+ *	and target memory is simulated (see mon_memptr() in monitor.h).
+ *
+*/
+#ifndef mon_linuxtest_h
+#define mon_linuxtest_h	1
+
+#include "monitor.h"
+
+#if MON_BOARD != MON_LINUXTEST
+#error	"mon-linuxtest.h is only for the linux test board"
+#endif
+
+extern int linuxtest_getc(void);
+extern int linuxtest_putc(int c);
+extern void linuxtest_flush(void);
+extern int linuxtest_rxready(void);
+extern int linuxtest_setbaud(uint32_t baud);
+extern int linuxtest_setflow(int level);
+extern uint32_t linuxtest_time_us(void);
+
+#endif
@@ -0,0 +1,208 @@
+/*  mon-pl011.h - PL011 uart on bcm2835 etc. (raspberry pi)
+ *
+ *  Copyright 2020 David Haworth
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef mon_pl011_h
+#define mon_pl011_h	1
+
+#include "mon-bcm2835.h"
+
+/* The ARM PL011 uart ("UART0" in the BCM2835 doc).
+ *
+ * Unlike the mini uart, its baud rate doesn't depend on the VPU core clock, and it has
+ * 16-deep fifos with programmable interrupt levels and a fractional baud divisor.
+ *
+ * On the Pi 3 the PL011 is normally used for Bluetooth. To get it on gpio14/15, put
+ * dtoverlay=disable-bt (or miniuart-bt) in config.txt.
+*/
+typedef struct pl011_uart_s pl011_uart_t;
+
+struct pl011_uart_s
+{
+	reg32_t dr;			/* 0x00	data (bits 0..7) and receive errors (8..11) */
+	reg32_t rsrecr;		/* 0x04	receive status/error clear */
+	reg32_t pad1[4];
+	reg32_t fr;			/* 0x18	flags */
+	reg32_t pad2;
+	reg32_t ilpr;		/* 0x20	not used */
+	reg32_t ibrd;		/* 0x24	integer baud divisor */
+	reg32_t fbrd;		/* 0x28	fractional baud divisor (64ths) */
+	reg32_t lcrh;		/* 0x2c	line control; writing it latches ibrd and fbrd */
+	reg32_t cr;			/* 0x30	control */
+	reg32_t ifls;		/* 0x34	interrupt fifo level select */
+	reg32_t imsc;		/* 0x38	interrupt mask set/clear (1 = enabled) */
+	reg32_t ris;		/* 0x3c	raw interrupt status */
+	reg32_t mis;		/* 0x40	masked interrupt status */
+	reg32_t icr;		/* 0x44	interrupt clear */
+	reg32_t dmacr;		/* 0x48	DMA control */
+};
+
+#define pl011_uart	((pl011_uart_t *)(BCM2835_PBASE+0x201000))[0]
+
+/* The uart clock is set by the firmware: 48 MHz on the Pi 3 (init_uart_clock in config.txt).
+ *	divisor = clock / (16 * baud), in 64ths
+*/
+#ifndef PL011_CLK
+#define PL011_CLK	48000000
+#endif
+
+#define PL011_DR_OE			0x800	/* Overrun: the fifo was full when this character arrived */
+#define PL011_DR_BE			0x400	/* Break */
+#define PL011_DR_PE			0x200	/* Parity error */
+#define PL011_DR_FE			0x100	/* Framing error */
+
+#define PL011_FR_TXFE		0x80	/* Transmit fifo empty */
+#define PL011_FR_RXFF		0x40	/* Receive fifo full */
+#define PL011_FR_TXFF		0x20	/* Transmit fifo full */
+#define PL011_FR_RXFE		0x10	/* Receive fifo empty */
+#define PL011_FR_BUSY		0x08	/* Transmitting (fifo not empty or shift register busy) */
+#define PL011_FR_CTS		0x01	/* 1 = CTS asserted */
+
+#define PL011_LCRH_8bit		0x60
+#define PL011_LCRH_7bit		0x40
+#define PL011_LCRH_FEN		0x10	/* Fifos enabled */
+
+#define PL011_CR_CTSEN		0x8000	/* Transmitter stops while CTS is de-asserted */
+#define PL011_CR_RTSEN		0x4000	/* RTS is de-asserted when the rx fifo reaches the rx level */
+#define PL011_CR_RXE		0x0200
+#define PL011_CR_TXE		0x0100
+#define PL011_CR_UARTEN		0x0001
+
+/* ifls: interrupt when the rx fifo fills to / the tx fifo drains to the level.
+*/
+#define PL011_IFLS_1_8		0
+#define PL011_IFLS_1_4		1
+#define PL011_IFLS_1_2		2
+#define PL011_IFLS_3_4		3
+#define PL011_IFLS_7_8		4
+#define PL011_IFLS(rx, tx)	(((rx) << 3) | (tx))
+
+#define PL011_INT_OE		0x400	/* Overrun */
+#define PL011_INT_RT		0x040	/* Receive timeout: characters in the rx fifo, line idle */
+#define PL011_INT_TX		0x020	/* Tx fifo has drained to the tx level */
+#define PL011_INT_RX		0x010	/* Rx fifo has filled to the rx level */
+#define PL011_INT_ALL		0x7ff
+
+extern void pl011_uart_init(uint32_t baud, uint32_t bits, uint32_t parity);
+extern int pl011_uart_setbaud(uint32_t baud);
+extern int pl011_uart_baudok(uint32_t baud);
+extern int pl011_uart_setflow(int level);
+extern int pl011_uart_flow;
+
+/* Interrupt-driven receive and transmit: as for the mini uart (see mon-bcm2835.h).
+ *
+ * The receive interrupt comes when the fifo is half full, or when there's anything in
+ * it and the line has been idle for 32 bit times, so there's one interrupt per 8
+ * characters of a burst instead of one per character.
+ *
+ * The transmit interrupt only comes when the fifo drains past the tx level, not because
+ * it's empty. So pl011_uart_putc() starts the transmission itself (pl011_uart_txstart())
+ * when the interrupt isn't already busy with the ring (pl011_uart_txon).
+*/
+#define PL011_RXBUF_SIZE	4096	/* Must be a power of 2 */
+#define PL011_TXBUF_SIZE	4096	/* Must be a power of 2 */
+
+extern mon_ring_t pl011_rxring;
+extern mon_ring_t pl011_txring;
+extern int pl011_uart_irqmode;
+extern volatile int pl011_uart_txon;
+extern uint32_t pl011_uart_overruns;
+extern int pl011_uart_throttled;
+extern int pl011_uart_pumping;
+extern int pl011_uart_pump_alive;
+
+extern void pl011_uart_irq_start(void);
+extern void pl011_uart_irq_stop(void);
+extern void pl011_uart_irq(void);
+extern void pl011_uart_flush(void);
+extern void pl011_uart_txstart(void);
+extern void pl011_uart_pump_begin(void);
+extern void pl011_uart_pump_end(void);
+extern int pl011_uart_pump(int c);
+extern void pl011_uart_unthrottle(void);
+
+static inline int pl011_uart_istx(void)
+{
+	return ( (pl011_uart.fr & PL011_FR_TXFF) == 0 );
+}
+
+static inline int pl011_uart_isrx(void)
+{
+	return ( (pl011_uart.fr & PL011_FR_RXFE) == 0 );
+}
+
+static inline int pl011_uart_rxready(void)
+{
+#if MON_UART_IRQ
+	if ( pl011_uart_irqmode )
+		return ( mon_ring_count(&pl011_rxring) != 0 );
+#endif
+	return pl011_uart_isrx();
+}
+
+static inline int pl011_uart_putc(int c)
+{
+#if MON_UART_IRQ
+	if ( pl011_uart_irqmode && bcm2835_core_id() == 0 )
+	{
+		while ( mon_ring_space(&pl011_txring) == 0 )
+		{
+			/* Wait till the interrupt handler makes room */
+		}
+		mon_ring_put(&pl011_txring, (uint8_t)c);
+		if ( !pl011_uart_txon )
+			pl011_uart_txstart();
+		return 1;
+	}
+#endif
+	while ( !pl011_uart_istx() )
+	{
+		/* Wait till there's room */
+	}
+	pl011_uart.dr = c;
+	return 1;
+}
+
+static inline int pl011_uart_getc(void)
+{
+	uint32_t d;
+
+#if MON_UART_IRQ
+	if ( pl011_uart_irqmode )
+	{
+		int c;
+
+		while ( mon_ring_count(&pl011_rxring) == 0 )
+		{
+			/* Wait till the interrupt handler delivers a character */
+		}
+		c = (int)mon_ring_get(&pl011_rxring);
+		if ( pl011_uart_throttled )
+			pl011_uart_unthrottle();
+		return c;
+	}
+#endif
+	while ( !pl011_uart_isrx() )
+	{
+		/* Wait till there's a character */
+	}
+	d = pl011_uart.dr;
+	if ( (d & PL011_DR_OE) != 0 )
+		pl011_uart_overruns++;
+	return (int)(d & 0xff);
+}
+
+#endif
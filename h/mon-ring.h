@@ -0,0 +1,75 @@
+/*	mon-ring.h - single-producer/single-consumer ring buffer for monitor
+ *
+ *	Copyright 2020 David Haworth
+ *
+ *	This file is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2, or (at your option)
+ *	any later version.
+ *
+ *	It is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; see the file COPYING.  If not, write to
+ *	the Free Software Foundation, 59 Temple Place - Suite 330,
+ *	Boston, MA 02111-1307, USA.
+ *
+ *
+ *	A lock-free byte ring with one producer and one consumer. The producer
+ *	and consumer can be an interrupt handler and the main loop, or two cores.
+ *
+ *	head and tail are free-running counters; the size must be a power of 2.
+ *	Only the producer writes head and only the consumer writes tail. The
+ *	release/acquire pairs make sure that the data is visible before the index.
+ *
+*/
+#ifndef mon_ring_h
+#define mon_ring_h	1
+
+#include "monitor.h"
+
+typedef struct mon_ring_s mon_ring_t;
+
+struct mon_ring_s
+{
+	uint32_t head;		/* Next slot to write (producer) */
+	uint32_t tail;		/* Next slot to read (consumer) */
+	uint32_t mask;		/* size - 1 */
+	uint8_t *buf;
+};
+
+#define MON_RING_INIT(b)	{ 0, 0, sizeof(b)-1, (b) }
+
+static inline uint32_t mon_ring_count(mon_ring_t *r)
+{
+	return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+static inline uint32_t mon_ring_space(mon_ring_t *r)
+{
+	return r->mask + 1 - mon_ring_count(r);
+}
+
+/* mon_ring_put() - add a byte. The caller must make sure there's space.
+*/
+static inline void mon_ring_put(mon_ring_t *r, uint8_t c)
+{
+	uint32_t h = r->head;
+	r->buf[h & r->mask] = c;
+	__atomic_store_n(&r->head, h+1, __ATOMIC_RELEASE);
+}
+
+/* mon_ring_get() - remove a byte. The caller must make sure there's one there.
+*/
+static inline uint8_t mon_ring_get(mon_ring_t *r)
+{
+	uint32_t t = r->tail;
+	uint8_t c = r->buf[t & r->mask];
+	__atomic_store_n(&r->tail, t+1, __ATOMIC_RELEASE);
+	return c;
+}
+
+#endif
@@ -26,27 +26,124 @@
 #define mon_stdio_h
 
 #include "monitor.h"
+
+#define MON_DEFAULT_BAUD	115200
+
+/* Select the console device and time base for the board (and, on the pi, MON_CONSOLE).
+*/
+#if MON_BOARD == MON_LINUXTEST
+#include "mon-linuxtest.h"
+#define mon_console_getc()		linuxtest_getc()
+#define mon_console_putc(c)		linuxtest_putc(c)
+#define mon_console_rxready()	linuxtest_rxready()
+#define mon_console_baudok(b)	((b) != 0)
+#define mon_console_setbaud(b)	linuxtest_setbaud(b)
+#define mon_console_flowok(f)	((f) >= 0 && (f) <= 4)
+#define mon_console_setflow(f)	linuxtest_setflow(f)
+#define mon_console_flush()		linuxtest_flush()
+#define mon_console_release()	do { } while (0)
+#define mon_console_reclaim()	do { } while (0)
+#define mon_console_pipeline_start()	do { } while (0)
+#define mon_console_pipeline_stop()		do { } while (0)
+#define mon_time_us()			linuxtest_time_us()
+#define mon_console_overruns()	0UL
+#elif MON_CONSOLE == MON_PL011
+#include "mon-pl011.h"
+#define mon_console_getc()		pl011_uart_getc()
+#define mon_console_putc(c)		pl011_uart_putc(c)
+#define mon_console_rxready()	pl011_uart_rxready()
+#define mon_console_baudok(b)	pl011_uart_baudok(b)
+#define mon_console_setbaud(b)	pl011_uart_setbaud(b)
+#define mon_console_flowok(f)	((f) >= 0 && (f) <= 4)
+#define mon_console_setflow(f)	pl011_uart_setflow(f)
+#define mon_console_flush()		pl011_uart_flush()
+#define mon_console_release()	do { mon_pipeline_stop(); pl011_uart_irq_stop(); } while (0)
+#define mon_console_reclaim()	pl011_uart_irq_start()
+#define mon_console_pipeline_start()	mon_pipeline_start()
+#define mon_console_pipeline_stop()		mon_pipeline_stop()
+#define mon_time_us()			bcm2835_time_us()
+#define mon_console_overruns()	((unsigned long)pl011_uart_overruns)
+#define mon_uart_init(b)		pl011_uart_init(b, 8, 0)
+#define mon_uart_irq_start()	pl011_uart_irq_start()
+#define mon_uart_irqmode		pl011_uart_irqmode
+#define mon_uart_pumping		pl011_uart_pumping
+#define mon_uart_pump_alive		pl011_uart_pump_alive
+#define mon_uart_pump_begin()	pl011_uart_pump_begin()
+#define mon_uart_pump_end()		pl011_uart_pump_end()
+#define mon_uart_pump(c)		pl011_uart_pump(c)
+extern int mon_pipeline_start(void);
+extern void mon_pipeline_stop(void);
+#else
 #include "mon-bcm2835.h"
+#define mon_console_getc()		bcm2835_uart_getc()
+#define mon_console_putc(c)		bcm2835_uart_putc(c)
+#define mon_console_rxready()	bcm2835_uart_rxready()
+#define mon_console_baudok(b)	bcm2835_uart_baudok(b)
+#define mon_console_setbaud(b)	bcm2835_uart_setbaud(b)
+#define mon_console_flowok(f)	((f) >= 0 && (f) <= 4)
+#define mon_console_setflow(f)	bcm2835_uart_setflow(f)
+#define mon_console_flush()		bcm2835_uart_flush()
+#define mon_console_release()	do { mon_pipeline_stop(); bcm2835_uart_irq_stop(); } while (0)
+#define mon_console_reclaim()	bcm2835_uart_irq_start()
+#define mon_console_pipeline_start()	mon_pipeline_start()
+#define mon_console_pipeline_stop()		mon_pipeline_stop()
+#define mon_time_us()			bcm2835_time_us()
+#define mon_console_overruns()	((unsigned long)bcm2835_uart_overruns)
+#define mon_uart_init(b)		bcm2835_uart_init(b, 8, 0)
+#define mon_uart_irq_start()	bcm2835_uart_irq_start()
+#define mon_uart_irqmode		bcm2835_uart_irqmode
+#define mon_uart_pumping		bcm2835_uart_pumping
+#define mon_uart_pump_alive		bcm2835_uart_pump_alive
+#define mon_uart_pump_begin()	bcm2835_uart_pump_begin()
+#define mon_uart_pump_end()		bcm2835_uart_pump_end()
+#define mon_uart_pump(c)		bcm2835_uart_pump(c)
+extern int mon_pipeline_start(void);
+extern void mon_pipeline_stop(void);
+#endif
+
+/* mon_console_rxready() returns nonzero if m_readchar() won't wait.
+ * mon_console_baudok() returns nonzero if the baud rate is possible.
+ * mon_console_setbaud() changes the baud rate; returns 0 if OK, -1 if the rate isn't possible.
+ * mon_console_flowok() returns nonzero if the RTS/CTS flow control level is possible (0 = off).
+ * mon_console_setflow() turns RTS/CTS flow control on or off; returns as mon_console_setbaud().
+ * mon_console_flush() waits until all buffered output has been sent.
+ * mon_console_release() hands the console device over to a loaded program (polled, no interrupts).
+ * mon_console_reclaim() takes it back when the program returns.
+ * mon_console_pipeline_start() uses another core (if one is free) to receive while core 0
+ * processes a download; mon_console_pipeline_stop() goes back to normal.
+ * mon_console_overruns() returns the number of receive overruns (characters lost) since reset.
+ *
+ * On the pi the mon_uart_... names select the console uart's driver for board-start.c.
+*/
 
 extern int m_printf(char *fmt, ...);
 extern char *m_gets(char *buf, int max);
+extern int m_readchar_timeout(uint32_t us);
+extern void m_delay_us(uint32_t us);
 extern int m_echo;
+extern unsigned long m_rx_count;
 
 static inline char m_readchar(void)
 {
-	return (char)bcm2835_uart_getc();
+	m_rx_count++;
+	return (char)mon_console_getc();
 }
 
 static inline void m_writechar(char c)
 {
-	bcm2835_uart_putc((int)c);
+	mon_console_putc((int)c);
+}
+
+static inline void m_flush(void)
+{
+	mon_console_flush();
 }
 
 static inline void m_putc(char c)
 {
 	if ( c == '\n' )
-		bcm2835_uart_putc((int)'\r');
-	bcm2835_uart_putc((int)c);
+		mon_console_putc((int)'\r');
+	mon_console_putc((int)c);
 }
 
 #endif
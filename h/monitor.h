@@ -33,6 +33,15 @@
 #define MON_BOARD 		MON_PI3_ARM64
 #endif
 
+/* The console uart on the pi: the mini uart or the PL011 (see mon-pl011.h).
+*/
+#define MON_MINIUART	1
+#define MON_PL011		2
+
+#ifndef MON_CONSOLE
+#define MON_CONSOLE		MON_MINIUART
+#endif
+
 typedef unsigned int uint32_t;
 typedef unsigned short uint16_t;
 typedef unsigned char uint8_t;
@@ -55,14 +64,25 @@ typedef uint32_t maxword_t;
 
 #define BCM2835_PBASE	0x20000000
 
+#elif MON_BOARD == MON_LINUXTEST
+
+#define MON_64BIT	1
+typedef unsigned long uint64_t;
+typedef uint64_t memaddr_t;
+typedef uint64_t maxword_t;
+
 #else
 #error "Unknown/unsupported MON_BOARD"
 #endif
 
-typedef void (*pokefunc_t)(memaddr_t a, uint8_t b);
+typedef int (*sinkfunc_t)(memaddr_t a, const uint8_t *p, int n);
+typedef int (*streamfunc_t)(const uint8_t *p, int n);
 typedef void (*vfuncv_t)(void);
+typedef void (*rangefunc_t)(memaddr_t a, memaddr_t n);
 
+#ifndef NULL
 #define NULL	0
+#endif
 #define MAXLINE	1024
 
 #define SREC_EOF		1
@@ -70,29 +90,119 @@ typedef void (*vfuncv_t)(void);
 #define SREC_BADLEN		(-2)
 #define SREC_NONHEX		(-3)
 #define SREC_BADCK		(-4)
+#define SREC_BADADDR	(-5)
+
+#define BIN_EOF			1
+#define BIN_TIMEOUT		(-1)
+#define BIN_CANCEL		(-2)
+#define BIN_BADADDR		(-3)
+
+#define UP_TIMEOUT		(-1)
+#define UP_CANCEL		(-2)
+
+#define XM_TIMEOUT		(-1)
+#define XM_CANCEL		(-2)
+#define XM_ERROR		(-3)
+
+#define ELF_BADHDR		(-1)
+#define ELF_BADPH		(-2)
+#define ELF_BADADDR		(-3)
+#define ELF_INCOMPLETE	(-4)
 
 extern int good_count;
 extern int bad_count;
 
-#define	peek8(a)		(*(uint8_t *)(a))
-#define	peek16(a)		(*(uint16_t *)(a))
-#define	peek32(a)		(*(uint32_t *)(a))
-#define poke8(a, v)		(*(uint8_t *)(a) = (v))
-#define poke16(a, v)	(*(uint16_t *)(a) = (v))
-#define poke32(a, v)	(*(uint32_t *)(a) = (v))
+extern void mon_stats_begin(unsigned long rx);
+extern void mon_stats_record(int n);
+extern void mon_stats_info(void);
+
+/* mon_memptr() converts a target address to a pointer that the monitor can use.
+ * On real hardware that's just a cast. The linux test board maps target
+ * addresses into a simulated RAM area.
+ * mon_memspan() is how many of the n bytes from a can be reached through one mon_memptr(a):
+ * on the linux test board a range mustn't run off the end of the simulated RAM.
+*/
+#if MON_BOARD == MON_LINUXTEST
+
+#define LINUXTEST_RAMSIZE	0x20000000	/* 512 MiB; must be a power of 2 */
+extern uint8_t *linuxtest_ram;
+#define mon_memptr(a)	((void *)(linuxtest_ram + ((memaddr_t)(a) & (LINUXTEST_RAMSIZE-1))))
+#define mon_memspan(a, n)	\
+	( (n) < LINUXTEST_RAMSIZE - ((memaddr_t)(a) & (LINUXTEST_RAMSIZE-1)) ? \
+		(n) : LINUXTEST_RAMSIZE - ((memaddr_t)(a) & (LINUXTEST_RAMSIZE-1)) )
+
+extern void linuxtest_go(memaddr_t a);
+#define go(a)			linuxtest_go(a)
+
+#else
+
+#define mon_memptr(a)	((void *)(a))
+#define mon_memspan(a, n)	(n)
+#define go(a)			((*(vfuncv_t)(a))())
+
+#endif
+
+#define	peek8(a)		(*(uint8_t *)mon_memptr(a))
+#define	peek16(a)		(*(uint16_t *)mon_memptr(a))
+#define	peek32(a)		(*(uint32_t *)mon_memptr(a))
+#define poke8(a, v)		(*(uint8_t *)mon_memptr(a) = (v))
+#define poke16(a, v)	(*(uint16_t *)mon_memptr(a) = (v))
+#define poke32(a, v)	(*(uint32_t *)mon_memptr(a) = (v))
 
 #if MON_64BIT
-#define	peek64(a)		(*(uint64_t *)(a))
-#define poke64(a, v)	(*(uint64_t *)(a) = (v))
+#define	peek64(a)		(*(uint64_t *)mon_memptr(a))
+#define poke64(a, v)	(*(uint64_t *)mon_memptr(a) = (v))
 #endif
 
-#define go(a)			((*(vfuncv_t)(a))())
 extern void release(int c, memaddr_t a);
 
 extern void monitor(char *prompt);
-extern int process_s_record(char *line, pokefunc_t _poke);
+extern int process_s_record(char *line, sinkfunc_t _sink);
+extern const signed char m_hexval[256];
+extern int mon_write(memaddr_t a, const uint8_t *p, int n);
+extern void mon_zero(memaddr_t a, memaddr_t n);
+extern void mon_parallel(rangefunc_t fn, memaddr_t a, memaddr_t n);
+extern int mon_parallel_cores(rangefunc_t fn, memaddr_t a, memaddr_t n, int max);
+extern void mon_clear_low(void);
+extern void mon_sync_code(void);
 extern int char2hex(char c);
 extern maxword_t gethex(char **pp, int max);
+extern maxword_t getdec(char **pp, int max);
+extern uint32_t m_crc32(uint32_t crc, const uint8_t *p, unsigned long n);
+extern uint32_t mon_crc32_range(memaddr_t a, memaddr_t n);
+#if MON_64BIT
+typedef struct m_xxh64_s m_xxh64_t;
+struct m_xxh64_s
+{
+	uint64_t v[4];			/* The four lanes */
+	uint64_t seed;
+	uint64_t total;			/* Number of bytes so far */
+	uint8_t buf[32];		/* Bytes that don't fill a stripe yet */
+	int nbuf;
+};
+extern void m_xxh64_begin(m_xxh64_t *x, uint64_t seed);
+extern void m_xxh64_update(m_xxh64_t *x, const uint8_t *p, unsigned long n);
+extern uint64_t m_xxh64_end(m_xxh64_t *x);
+extern uint64_t m_xxh64(const uint8_t *p, unsigned long n, uint64_t seed);
+extern uint64_t mon_xxh64_range(memaddr_t a, memaddr_t n, uint64_t seed);
+#endif
+extern int bin_download(sinkfunc_t _sink);
+extern long bin_upload(memaddr_t a, memaddr_t n, int z);
+#if MON_64BIT
+extern long bin_hashes(memaddr_t a, memaddr_t n, memaddr_t bs);
+#endif
+extern long xmodem_receive(streamfunc_t out);
+extern void lz4_init(memaddr_t addr, sinkfunc_t _sink);
+extern int lz4_stream(const uint8_t *p, int n);
+extern long lz4_finish(void);
+extern int lz4_compress(const uint8_t *src, int n, uint8_t *dst, int max);
+extern void elf_init(sinkfunc_t _sink);
+extern int elf_stream(const uint8_t *p, int n);
+extern long elf_finish(memaddr_t *entry);
+
+/* Memory benchmark (the A command, see mon-bench.c)
+*/
+extern void mon_bench(memaddr_t a, memaddr_t l, memaddr_t stride, int ncores);
 
 
 /* Names for ASCII control codes